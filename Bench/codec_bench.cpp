@@ -0,0 +1,90 @@
+// codec_bench.cpp
+
+#include <benchmark/benchmark.h>
+#include "Codec.h"
+#include <random>
+
+
+// a batch of n updates: ids spread over 4 * n, half discrete (0 / 1), half analog (random walk)
+static VecSignal make_batch(size_t n, bool with_ts)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint32_t> ids(1, static_cast<uint32_t>(4 * n));
+    std::uniform_real_distribution<double> delta(-0.5, 0.5);
+
+    VecSignal batch;
+    batch.reserve(n);
+
+    double value = 100.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const bool analog = (i % 2) != 0;
+        value += delta(rng);
+
+        batch.emplace_back(ids(rng), analog ? ESignalType::analog : ESignalType::discret, analog ? value : double(rng() % 2),
+            with_ts ? std::chrono::steady_clock::now() : Signal::time_point());
+    }
+
+    return batch;
+}
+
+static WireFormat bench_format(int64_t index)
+{
+    static const WireFormat formats[] = { { 1, 0 }, { 2, 0 }, { 2, WIRE_OPT_FLOAT32 }, { 2, WIRE_OPT_TIMESTAMPS } };
+    return formats[index];
+}
+
+static const uint8_t ALL_TYPES = static_cast<uint8_t>(ESignalType::discret | ESignalType::analog);
+
+
+// args: batch size, format index (v1, v2, v2 float32, v2 timestamps)
+static void BM_Encode(benchmark::State& state)
+{
+    const WireFormat format = bench_format(state.range(1));
+    const VecSignal batch = make_batch(static_cast<size_t>(state.range(0)), format.options & WIRE_OPT_TIMESTAMPS);
+
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        SharedPayload payload = make_shared_payload(batch, ALL_TYPES, format);
+        bytes = payload->size();
+        benchmark::DoNotOptimize(payload->data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch.size());
+    state.counters["bytes_per_update"] = double(bytes) / batch.size();
+}
+BENCHMARK(BM_Encode)->ArgsProduct({ { 1, 64, 4096 }, { 0, 1, 2, 3 } });
+
+
+static void BM_Decode(benchmark::State& state)
+{
+    const WireFormat format = bench_format(state.range(1));
+    const VecSignal batch = make_batch(static_cast<size_t>(state.range(0)), format.options & WIRE_OPT_TIMESTAMPS);
+    const SharedPayload payload = make_shared_payload(batch, ALL_TYPES, format);
+
+    for (auto _ : state)
+    {
+        double sum = 0;
+
+        if (format.version >= 2)
+        {
+            decode_signals_v2(payload->data(), payload->size(), [&sum](const Signal& s) { sum += s.value; });
+        }
+        else
+        {
+            Signal s;
+            for (size_t pos = 0; pos + SIGNAL_RECORD_SIZE <= payload->size(); pos += SIGNAL_RECORD_SIZE)
+            {
+                decode_signal(payload->data() + pos, s);
+                sum += s.value;
+            }
+        }
+
+        benchmark::DoNotOptimize(sum);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch.size());
+    state.SetBytesProcessed(state.iterations() * payload->size());
+}
+BENCHMARK(BM_Decode)->ArgsProduct({ { 1, 64, 4096 }, { 0, 1, 2, 3 } });
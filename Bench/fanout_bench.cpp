@@ -0,0 +1,201 @@
+// fanout_bench.cpp
+
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include "Server.h"
+#include "Codec.h"
+#include <array>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using error_code = boost::system::error_code;
+
+
+// true if the process may open n more descriptors (the soft limit is raised up to the hard one)
+static bool reserve_descriptors(size_t n)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) != 0)
+    {
+        return false;
+    }
+
+    if (lim.rlim_cur != RLIM_INFINITY && lim.rlim_cur < n + 64)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+        getrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    return lim.rlim_cur == RLIM_INFINITY || lim.rlim_cur >= n + 64;
+#else
+    (void)n;
+    return true;
+#endif
+}
+
+
+// Server with n in-process subscribers: raw loopback sockets that subscribe to everything
+// and discard what they receive (no client-side decoding in the measurement).
+class FanOutRig
+{
+public:
+    static const uint32_t SIGNALS = 1000;
+
+    FanOutRig(size_t sessions, size_t fanout_threads)
+        : m_server(m_io_server, 0)
+    {
+        m_server.EnableDataEmulation(false);
+        m_server.EnableShowLogMsg(false);
+
+        HeartbeatPolicy heartbeat;
+        heartbeat.alive_interval = std::chrono::milliseconds(0);
+        heartbeat.drain_timeout = std::chrono::milliseconds(0);
+        m_server.SetHeartbeatPolicy(heartbeat);
+        m_server.SetFanOutThreads(fanout_threads);
+
+        VecSignal signals;
+        for (uint32_t id = 1; id <= SIGNALS; id++)
+        {
+            signals.emplace_back(id, ESignalType::analog, 0.0);
+        }
+        m_server.SetSignalsAndWait(signals);
+        m_server.Start();
+
+        m_thread_server = std::thread([this]() { m_io_server.run(); });
+
+        SubscribeRequest req;
+        req.mask = static_cast<uint8_t>(ESignalType::discret | ESignalType::analog);
+        std::vector<uint8_t> payload = encode_subscribe(req);
+
+        SSignalProtocolHeader hdr = make_header(0x01, 0, static_cast<uint32_t>(payload.size()));
+        std::vector<uint8_t> frame(sizeof(hdr) + payload.size());
+        std::memcpy(frame.data(), &hdr, sizeof(hdr));
+        std::memcpy(frame.data() + sizeof(hdr), payload.data(), payload.size());
+
+        const tcp::endpoint endpoint(asio::ip::address_v4::loopback(), m_server.GetPort());
+
+        for (size_t i = 0; i < sessions; i++)
+        {
+            m_sockets.emplace_back(std::make_unique<tcp::socket>(m_io_clients));
+            m_sockets.back()->connect(endpoint);
+            asio::write(*m_sockets.back(), asio::buffer(frame));
+            drain(*m_sockets.back());
+        }
+
+        m_thread_clients = std::thread([this]() { m_io_clients.run(); });
+
+        const auto start = std::chrono::steady_clock::now();
+        while (m_server.GetSubscriberCount() != sessions && std::chrono::steady_clock::now() - start < std::chrono::seconds(30))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        m_ready = m_server.GetSubscriberCount() == sessions;
+
+        // let the snapshots go out
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    ~FanOutRig()
+    {
+        m_server.Stop();
+        m_io_server.stop();
+        m_io_clients.stop();
+
+        m_thread_server.join();
+        m_thread_clients.join();
+    }
+
+    bool Ready() const { return m_ready; }
+    Server& GetServer() { return m_server; }
+
+private:
+    void drain(tcp::socket& socket)
+    {
+        socket.async_read_some(asio::buffer(m_discard),
+            [this, &socket](error_code ec, std::size_t /*n*/)
+            {
+                if (!ec)
+                {
+                    drain(socket);
+                }
+            });
+    }
+
+private:
+    asio::io_context m_io_server;
+    asio::io_context m_io_clients;
+
+    Server m_server;
+    std::vector<std::unique_ptr<tcp::socket>> m_sockets;
+    std::array<uint8_t, 64 * 1024> m_discard;      // shared, the content is never looked at
+
+    std::thread m_thread_server;
+    std::thread m_thread_clients;
+    bool m_ready{ false };
+};
+
+
+// args: sessions, fan-out threads; one update per iteration, timed until every session has written it
+static void BM_FanOut(benchmark::State& state)
+{
+    const size_t sessions = static_cast<size_t>(state.range(0));
+
+    if (!reserve_descriptors(2 * sessions))
+    {
+        state.SkipWithError("not enough file descriptors");
+        return;
+    }
+
+    FanOutRig rig(sessions, static_cast<size_t>(state.range(1)));
+    if (!rig.Ready())
+    {
+        state.SkipWithError("sessions did not subscribe");
+        return;
+    }
+
+    Server& server = rig.GetServer();
+    const ShardedCounter& frames_sent = server.GetCounters().frames_sent;
+
+    // wait for the frames still in flight from the set-up
+    uint64_t sent = frames_sent.Value();
+    for (uint64_t prev = UINT64_MAX; prev != sent; sent = frames_sent.Value())
+    {
+        prev = sent;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    uint32_t id = 1;
+    double value = 0;
+
+    for (auto _ : state)
+    {
+        server.PushSignal({ id, ESignalType::analog, ++value, std::chrono::steady_clock::now() });
+        id = id % (FanOutRig::SIGNALS - 1) + 1;
+
+        sent += sessions;
+
+        const auto start = std::chrono::steady_clock::now();
+        while (frames_sent.Value() < sent)
+        {
+            if (std::chrono::steady_clock::now() - start > std::chrono::seconds(10))
+            {
+                state.SkipWithError("fan-out stalled");
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * sessions);
+    state.counters["sessions"] = double(sessions);
+}
+BENCHMARK(BM_FanOut)->ArgsProduct({ { 1, 10, 100, 1000, 10000 }, { 1, 4 } })->UseRealTime()->Unit(benchmark::kMicrosecond);
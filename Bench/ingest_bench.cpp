@@ -0,0 +1,115 @@
+// ingest_bench.cpp
+
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include "Server.h"
+#include <memory>
+
+
+static VecSignal make_signals(size_t n)
+{
+    VecSignal signals;
+    signals.reserve(n);
+
+    for (uint32_t id = 1; id <= n; id++)
+    {
+        signals.emplace_back(id, (id % 2) ? ESignalType::analog : ESignalType::discret, 0.0);
+    }
+
+    return signals;
+}
+
+// server without sessions; SetSignals is applied by the dispatcher
+struct BenchServer
+{
+    explicit BenchServer(size_t signals)
+        : server(io, 0)
+    {
+        server.EnableDataEmulation(false);
+        server.EnableShowLogMsg(false);
+        server.SetSignalsAndWait(make_signals(signals));     // returns once the set is in the store
+    }
+
+    boost::asio::io_context io;
+    Server server;
+};
+
+
+static const size_t INGEST_SIGNALS = 10000;
+static std::unique_ptr<BenchServer> g_ingest;
+
+static void ingest_setup(const benchmark::State&)
+{
+    g_ingest = std::make_unique<BenchServer>(INGEST_SIGNALS);
+}
+
+static void ingest_teardown(const benchmark::State&)
+{
+    g_ingest.reset();
+}
+
+// producer threads pushing distinct ids, through the ingest ring to the dispatcher
+static void BM_PushSignal(benchmark::State& state)
+{
+    Server& server = g_ingest->server;
+
+    const uint32_t threads = static_cast<uint32_t>(state.threads());
+    uint32_t id = 1 + static_cast<uint32_t>(state.thread_index());
+    double value = 0;
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(server.PushSignal({ id, (id % 2) ? ESignalType::analog : ESignalType::discret, value, std::chrono::steady_clock::now() }));
+
+        id += threads;
+        if (id > INGEST_SIGNALS)
+        {
+            id = 1 + static_cast<uint32_t>(state.thread_index());
+            value += 1;
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PushSignal)->Setup(ingest_setup)->Teardown(ingest_teardown)->ThreadRange(1, 8)->UseRealTime();
+
+
+static void BM_PushSignals(benchmark::State& state)
+{
+    Server& server = g_ingest->server;
+
+    VecSignal block = make_signals(static_cast<size_t>(state.range(0)));
+    double value = 0;
+
+    for (auto _ : state)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        value += 1;
+        for (auto& s : block)
+        {
+            s.value = value;
+            s.ts = now;
+        }
+
+        benchmark::DoNotOptimize(server.PushSignals(block));
+    }
+
+    state.SetItemsProcessed(state.iterations() * block.size());
+}
+BENCHMARK(BM_PushSignals)->Setup(ingest_setup)->Teardown(ingest_teardown)->Arg(64)->Arg(4096)->UseRealTime();
+
+
+// arg: signal count
+static void BM_GetSnapshot(benchmark::State& state)
+{
+    BenchServer bench(static_cast<size_t>(state.range(0)));
+
+    for (auto _ : state)
+    {
+        VecSignal snap = bench.server.GetSnapshot(static_cast<uint8_t>(ESignalType::discret | ESignalType::analog));
+        benchmark::DoNotOptimize(snap.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GetSnapshot)->Arg(1000)->Arg(100 * 1000)->Arg(1000 * 1000)->Unit(benchmark::kMicrosecond);
@@ -6,7 +6,9 @@
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <algorithm>
 #include <Utils.h>
+#include <Codec.h>
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
@@ -53,10 +55,22 @@ void Client::Stop()
 }
 
 MapSignal Client::GeSignals()
+{
+    SharedSignalTable table = GetSnapshot();
+
+    MapSignal signals;
+    for (const auto& s : table->signals)
+    {
+        signals.emplace(s.id, s);
+    }
+    return signals;
+}
+
+SharedSignalTable Client::GetSnapshot()
 {
     std::lock_guard<std::mutex> lock(m_mtx_signal);
 
-    return m_map_signal;
+    return m_table;
 }
 
 void Client::connect()
@@ -94,7 +108,9 @@ void Client::connect()
                     if (m_show_log_msg)
                         std::cout << "Connected to server\n";
 
-                    clear_data();
+                    // resuming / reconciling: the signals stay, the server sends what was missed,
+                    // the differing buckets or a reset + full state
+                    clear_data((m_resume && m_last_seq != 0) || (m_reconcile && !GetSnapshot()->signals.empty()));
 
                     send_subscribe();
                 });
@@ -104,8 +120,33 @@ void Client::connect()
 void Client::send_subscribe()
 {
     // Build subscribe payload
-    std::vector<uint8_t> payload;
-    payload.push_back(static_cast<uint8_t>(m_signal_type));
+    SubscribeRequest req;
+    req.mask = static_cast<uint8_t>(m_signal_type);
+    req.filter_ids = m_filter_ids;
+    req.id_ranges = m_id_ranges;
+    req.format = m_wire;
+
+    if (m_resume || m_reconcile)
+    {
+        req.format.version = std::max<uint8_t>(req.format.version, 2);
+        req.format.options |= WIRE_OPT_SEQUENCE;
+    }
+
+    if (m_resume)
+    {
+        req.resume_seq = m_last_seq;
+    }
+
+    if (m_reconcile)
+    {
+        SharedSignalTable table = GetSnapshot();
+        if (!table->signals.empty())
+        {
+            req.digests = compute_digests(table->signals, digest_bucket_count(table->signals.size()), req.format.options);
+        }
+    }
+
+    std::vector<uint8_t> payload = encode_subscribe(req);
 
     // Header
     SSignalProtocolHeader hdr;
@@ -139,20 +180,38 @@ void Client::send_subscribe()
                 return;
             }
 
-            start_read_header();
+            start_read();
         });
 }
 
-void Client::start_read_header()
+void Client::start_read()
 {
     if (!m_socket.is_open())
     {
         return;
     }
 
-    asio::async_read(m_socket, asio::buffer(&m_header, sizeof(m_header)),
-        [this](const error_code& ec, std::size_t /*n*/)
+    // keep room for a large read: move the partial frame to the front, grow only for a bigger frame
+    if (m_rx.size() - m_rx_end < RX_MIN_READ)
+    {
+        std::memmove(m_rx.data(), m_rx.data() + m_rx_begin, m_rx_end - m_rx_begin);
+        m_rx_end -= m_rx_begin;
+        m_rx_begin = 0;
+
+        if (m_rx.size() - m_rx_end < RX_MIN_READ)
         {
+            m_rx.resize(m_rx_end + RX_MIN_READ);
+        }
+    }
+
+    m_socket.async_read_some(asio::buffer(m_rx.data() + m_rx_end, m_rx.size() - m_rx_end),
+        [this](const error_code& ec, std::size_t n)
+        {
+            if (ec == asio::error::operation_aborted)
+            {
+                return;
+            }
+
             if (ec)
             {
                 if (ec == asio::error::eof || ec == asio::error::connection_reset)
@@ -161,139 +220,296 @@ void Client::start_read_header()
                 }
                 else
                 {
-                    write_error("Read header error", ec);
+                    write_error("Read error", ec);
                 }
 
                 schedule_reconnect();
                 return;
             }
 
-            // validate header
-            SSignalProtocolHeader hdr = m_header;
-            if (net_to_host_u16(hdr.signature) != SIGNAL_HEADER_SIGNATURE)
+            m_rx_end += n;
+
+            if (parse_frames())
             {
-                std::cerr << "Bad signature in header\n";
-                schedule_reconnect();
-                return;
+                start_read();
             }
+        });
+}
+
+bool Client::parse_frames()
+{
+    // every complete frame of the buffer, in one completion
+    while (m_rx_end - m_rx_begin >= sizeof(SSignalProtocolHeader))
+    {
+        SSignalProtocolHeader hdr;
+        std::memcpy(&hdr, m_rx.data() + m_rx_begin, sizeof(hdr));
+
+        // validate header
+        if (net_to_host_u16(hdr.signature) != SIGNAL_HEADER_SIGNATURE)
+        {
+            std::cerr << "Bad signature in header\n";
+            schedule_reconnect();
+            return false;
+        }
+
+        if (hdr.version == 0 || hdr.version > MAX_WIRE_VERSION)
+        {
+            std::cerr << "Bad version\n";
+            schedule_reconnect();
+            return false;
+        }
 
-            if (hdr.version != 1)
+        uint32_t len = net_to_host_u32(hdr.len);
+
+        // sanity cap
+        if (len > 10 * 1024 * 1024)
+        {
+            std::cerr << "Packet too big, closing\n";
+            schedule_reconnect();
+            return false;
+        }
+
+        if (m_rx_end - m_rx_begin < sizeof(hdr) + len)
+        {
+            // partial frame: make sure the buffer can hold all of it
+            if (m_rx.size() - m_rx_begin < sizeof(hdr) + len + RX_MIN_READ)
             {
-                std::cerr << "Bad version\n";
-                schedule_reconnect();
-                return;
+                m_rx.resize(m_rx_begin + sizeof(hdr) + len + RX_MIN_READ);
             }
+            break;
+        }
+
+        uint8_t msg_num = m_cnt_packet % 256; // in header msg_num has type uint8_t !
+
+        if (hdr.msg_num != msg_num)
+        {
+            std::cerr << "Bad header_msg_num = " << static_cast<unsigned int>(hdr.msg_num) << " waiting msg_num = " << static_cast<unsigned int>(msg_num) << "\n";
+            schedule_reconnect();
+            return false;
+        }
+
+        m_cnt_packet++;
+
+        m_header = hdr;
+        const uint8_t* body = m_rx.data() + m_rx_begin + sizeof(hdr);
+        m_body.assign(body, body + len);    // capacity is reused
+        m_rx_begin += sizeof(hdr) + len;
 
+        process_body(hdr.data_type, m_body);
+    }
 
-            uint8_t msg_num = m_cnt_packet % 256; // in header msg_num has type uint8_t !
+    if (m_rx_begin == m_rx_end)
+    {
+        m_rx_begin = m_rx_end = 0;
+    }
 
-            if (hdr.msg_num != msg_num)
+    return true;
+}
+
+void Client::process_body(uint8_t data_type, const std::vector<uint8_t>& body)
+{
+    if (data_type == 0x02)
+    {
+        // decode the whole frame first, then apply it under one lock
+        if (m_header.version >= 2)
+        {
+            m_decoded.clear();
+            if (!decode_signals_v2(body.data(), body.size(), [this](const Signal& s) { m_decoded.push_back(s); }, &m_decoded_seq))
             {
-                std::cerr << "Bad header_msg_num = " << static_cast<unsigned int>(hdr.msg_num) << " waiting msg_num = " << static_cast<unsigned int>(msg_num) << "\n";
-                schedule_reconnect();
+                std::cerr << "Bad v2 payload\n";
                 return;
             }
+        }
+        else
+        {
+            decode_signals(body.data(), body.size(), m_decoded);
+            m_decoded_seq = FrameSeq();
+        }
 
-            m_cnt_packet++;
+        const auto now = std::chrono::steady_clock::now();
 
-            uint32_t len = net_to_host_u32(hdr.len);
+        for (const auto& s : m_decoded)
+        {
+            if (s.ts != Signal::time_point())
+            {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - s.ts).count();
+                m_latency[s.type == ESignalType::analog ? 1 : 0].Record(us > 0 ? us : 0);
+            }
 
-            // sanity cap
-            if (len > 10 * 1024 * 1024)
+            if (m_show_log_msg)
             {
-                std::cerr << "Packet too big, closing\n";
-                schedule_reconnect();
-                return;
+                if (m_cnt_packet == 1)
+                    std::cout << "Init state: id=" << s.id << " type=" << int(s.type) << " val=" << s.value << "\n";
+                else
+                    std::cout << "Update: id=" << s.id << " type=" << int(s.type) << " val=" << s.value << "\n";
             }
+        }
 
-            start_read_body(len, hdr.data_type);
-        });
-}
+        apply_records(m_decoded, m_decoded_seq.reset);
 
-void Client::start_read_body(uint32_t len, uint8_t data_type)
-{
-    m_body.resize(len);
-    if (len == 0)
+        // a reset drops the old position until the last frame of the new state
+        if (m_decoded_seq.reset)
+        {
+            m_last_seq = 0;
+        }
+        if (m_decoded_seq.seq > m_last_seq)
+        {
+            m_last_seq = m_decoded_seq.seq;
+        }
+    }
+    else if (data_type == 0x03)
     {
-        process_body(data_type, m_body);
-        start_read_header();
-        return;
+        if (m_show_log_msg)
+            std::cout << "Alive msg\n";
     }
+    else if (data_type == 0x04)
+    {
+        if (!decode_schema_payload(body.data(), body.size(), m_schema))
+        {
+            std::cerr << "Bad schema payload\n";
+            return;
+        }
 
-    asio::async_read(m_socket, asio::buffer(m_body),
-        [this, data_type](const error_code& ec, std::size_t /*n*/)
+        if (m_show_log_msg)
         {
-            //if (ec == asio::error::operation_aborted)
-            //{
-            //    return;
-            //}
+            for (const auto& c : m_schema)
+                std::cout << (c.op == SCHEMA_ADDED ? "Added" : c.op == SCHEMA_REMOVED ? "Removed" : "Retyped") << ": id=" << c.signal.id << " type=" << int(c.signal.type) << "\n";
+        }
 
-            if (ec)
-            {
-                write_error("Read body error", ec);
-                schedule_reconnect();
-                return;
-            }
+        apply_schema(m_schema);
+    }
+    else if (data_type == 0x05)
+    {
+        uint32_t buckets;
+        if (!decode_reconcile_payload(body.data(), body.size(), buckets, m_resent))
+        {
+            std::cerr << "Bad reconcile payload\n";
+            return;
+        }
 
-            process_body(data_type, m_body);
-            start_read_header();
-        });
+        if (m_show_log_msg)
+            std::cout << "Reconcile: " << m_resent.size() << " of " << buckets << " buckets resent\n";
+
+        // the position comes with the last data frame of the resent buckets
+        apply_reconcile(buckets, m_resent);
+        m_last_seq = 0;
+    }
+    else
+    {
+        std::cout << "Unknown msg_data_type=" << int(data_type)  << "\n";
+    }
 }
 
-void Client::process_body(uint8_t data_type, const std::vector<uint8_t>& body)
+void Client::apply_records(const VecSignal& records, bool reset)
 {
-    if (data_type == 0x02)
+    if (records.empty() && !reset)
     {
-        size_t pos = 0;
-        while (pos + 13 <= body.size())
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtx_signal);
+
+    if (reset)
+    {
+        m_table = std::make_shared<SignalTable>();
+    }
+    // snapshots are handed out under this mutex, so the count cannot grow meanwhile
+    else if (m_table.use_count() > 1)
+    {
+        m_table = std::make_shared<SignalTable>(*m_table);
+    }
+
+    SignalTable& table = *m_table;
+
+    for (const auto& s : records)
+    {
+        auto it = table.index.emplace(s.id, static_cast<uint32_t>(table.signals.size()));
+        if (it.second)
+        {
+            table.signals.push_back(s);
+        }
+        else
         {
-            // id
-            uint32_t id;
-            std::memcpy(&id, body.data() + pos, 4);
-            id = ntohl(id);
-            pos += 4;
+            table.signals[it.first->second] = s;
+        }
+    }
+}
 
-            // type
-            uint8_t type = body[pos++];
+void Client::apply_schema(const VecSchemaChange& changes)
+{
+    std::lock_guard<std::mutex> lock(m_mtx_signal);
 
-            // value
-            uint64_t ubits;
-            std::memcpy(&ubits, body.data() + pos, 8);
-            ubits = net_to_host_u64(ubits);
-            pos += 8;
+    if (m_table.use_count() > 1)
+    {
+        m_table = std::make_shared<SignalTable>(*m_table);
+    }
 
-            double val;
-            std::memcpy(&val, &ubits, sizeof(val));
+    SignalTable& table = *m_table;
 
-            if (m_show_log_msg)
+    for (const auto& c : changes)
+    {
+        if (c.op != SCHEMA_REMOVED)
+        {
+            auto it = table.index.emplace(c.signal.id, static_cast<uint32_t>(table.signals.size()));
+            if (it.second)
             {
-                if(m_cnt_packet == 1)
-                    std::cout << "Init state: id=" << id << " type=" << int(type) << " val=" << val << "\n";
-                else
-                    std::cout << "Update: id=" << id << " type=" << int(type) << " val=" << val << "\n";
+                table.signals.push_back(c.signal);
             }
-
-
-            Signal s(id, static_cast<ESignalType>(type), val);
-            
+            else
             {
-                std::lock_guard<std::mutex> lock(m_mtx_signal);
-
-                m_map_signal[id] = s;
+                table.signals[it.first->second] = c.signal;
             }
+            continue;
+        }
 
+        auto it = table.index.find(c.signal.id);
+        if (it == table.index.end())
+        {
+            continue;
+        }
 
+        // move the last signal into the hole
+        const uint32_t hole = it->second;
+        table.index.erase(it);
+
+        if (hole + 1 != table.signals.size())
+        {
+            table.signals[hole] = table.signals.back();
+            table.index[table.signals[hole].id] = hole;
         }
+        table.signals.pop_back();
     }
-    else if (data_type == 0x03)
+}
+
+void Client::apply_reconcile(uint32_t buckets, const std::vector<uint32_t>& resent)
+{
+    if (resent.empty())
     {
-        if (m_show_log_msg)
-            std::cout << "Alive msg\n";
+        return;
     }
-    else
+
+    std::vector<bool> drop(buckets, false);
+    for (uint32_t b : resent)
     {
-        std::cout << "Unknown msg_data_type=" << int(data_type)  << "\n";
+        drop[b] = true;
     }
+
+    std::lock_guard<std::mutex> lock(m_mtx_signal);
+
+    // a new table: most of it is kept, but the positions change
+    auto table = std::make_shared<SignalTable>();
+    table->signals.reserve(m_table->signals.size());
+
+    for (const auto& s : m_table->signals)
+    {
+        if (!drop[digest_bucket(s.id, buckets)])
+        {
+            table->index.emplace(s.id, static_cast<uint32_t>(table->signals.size()));
+            table->signals.push_back(s);
+        }
+    }
+
+    m_table = std::move(table);
 }
 
 void Client::schedule_reconnect()
@@ -318,13 +534,21 @@ void Client::schedule_reconnect()
         });
 }
 
-void Client::clear_data()
+void Client::clear_data(bool keep_signals)
 {
     m_cnt_packet = 0;
+    m_rx_begin = m_rx_end = 0;
+
+    if (keep_signals)
+    {
+        return;
+    }
+
+    m_last_seq = 0;
 
     {
         std::lock_guard<std::mutex> lock(m_mtx_signal);
 
-        m_map_signal.clear();
+        m_table = std::make_shared<SignalTable>();
     }
 }
\ No newline at end of file
@@ -4,9 +4,32 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include "Protocol.h"
+#include "Codec.h"
+#include "Histogram.h"
 
 
+// Received signal values: flat array (in order of arrival, removals fill the hole with the last one)
+// plus an id -> position index.
+// Published as an immutable snapshot; the client updates it in place and copies it only
+// while a reader still holds the current snapshot (copy-on-write).
+struct SignalTable
+{
+    VecSignal signals;
+    std::unordered_map<uint32_t, uint32_t> index;   // id -> position in signals
+
+    const Signal* Find(uint32_t id) const
+    {
+        auto it = index.find(id);
+        return it == index.end() ? nullptr : &signals[it->second];
+    }
+};
+
+typedef std::shared_ptr<const SignalTable> SharedSignalTable;
+
 
 class Client
 {
@@ -24,17 +47,39 @@ public:
     void EnableShowLogMsg(bool is_enable) { m_show_log_msg = is_enable; }
     bool IsShowLogMsg() { return m_show_log_msg; }
 
-    MapSignal GeSignals();
+    // receive only these ids (set before Start(), applies from the next subscribe)
+    void SetIdFilter(const VecIdRange& ranges) { m_filter_ids = true; m_id_ranges = ranges; }
+
+    // data frame encoding requested in the subscribe (set before Start())
+    void SetWireFormat(const WireFormat& format) { m_wire = format; }
+
+    // after a reconnect, ask for the updates missed since the last one received instead of the whole
+    // state (requests wire version 2 with WIRE_OPT_SEQUENCE; set before Start())
+    void EnableResume(bool is_enable) { m_resume = is_enable; }
+    uint64_t GetLastSequence() const { return m_last_seq; }     // 0: no complete state yet
+
+    // after a reconnect, send bucket digests of the signals held, so that the server resends only the buckets
+    // that differ (when it cannot resume; requests wire version 2 with WIRE_OPT_SEQUENCE; set before Start())
+    void EnableReconcile(bool is_enable) { m_reconcile = is_enable; }
+
+    MapSignal GeSignals();                  // copy, ordered by id
+    SharedSignalTable GetSnapshot();        // no copy: stays unchanged while held
+
+    // source-to-client latency (microseconds) of the received records, needs WIRE_OPT_TIMESTAMPS
+    const Histogram& GetLatency(ESignalType type) const { return m_latency[type == ESignalType::analog ? 1 : 0]; }
     uint64_t GetPacketCount() { return m_cnt_packet; }
 
 private:
     void connect();
     void send_subscribe();
-    void start_read_header();
-    void start_read_body(uint32_t len, uint8_t data_type);
+    void start_read();
+    bool parse_frames();        // false after a protocol error (reconnect scheduled)
     virtual void process_body(uint8_t type, const std::vector<uint8_t>& body);
+    void apply_records(const VecSignal& records, bool reset);
+    void apply_schema(const VecSchemaChange& changes);
+    void apply_reconcile(uint32_t buckets, const std::vector<uint32_t>& resent);
     void schedule_reconnect();
-    void clear_data();
+    void clear_data(bool keep_signals);
 
 protected:
     boost::asio::io_context& m_io;
@@ -46,15 +91,37 @@ protected:
     std::string m_host;
     uint16_t m_port;
     ESignalType m_signal_type;
+    bool m_filter_ids{ false };
+    VecIdRange m_id_ranges;
+    WireFormat m_wire;
+    bool m_resume{ false };
+    bool m_reconcile{ false };
+
+    // sequence number of the last update held (frames with WIRE_OPT_SEQUENCE), kept across reconnects
+    std::atomic<uint64_t> m_last_seq{ 0 };
 
-    // inbound buffers/state
-    SSignalProtocolHeader m_header;
+    // inbound buffers/state: frames are parsed in place from m_rx[m_rx_begin, m_rx_end),
+    // which is filled by async_read_some and compacted before the next read
+    static const size_t RX_MIN_READ = 64 * 1024;
+
+    std::vector<uint8_t> m_rx = std::vector<uint8_t>(2 * RX_MIN_READ);
+    size_t m_rx_begin{ 0 };
+    size_t m_rx_end{ 0 };
+
+    SSignalProtocolHeader m_header;     // of the frame passed to process_body
     std::vector<uint8_t> m_body;
 
     std::atomic<uint64_t> m_cnt_packet{0};
 
+    // m_table is replaced or updated under m_mtx_signal, once per frame
     std::mutex m_mtx_signal;
-    MapSignal m_map_signal;
+    std::shared_ptr<SignalTable> m_table{ std::make_shared<SignalTable>() };
+    VecSignal m_decoded;                    // records of the current frame (io thread only)
+    FrameSeq m_decoded_seq;
+    VecSchemaChange m_schema;
+    std::vector<uint32_t> m_resent;         // buckets of the current reconcile frame
+
+    Histogram m_latency[2];     // discrete, analog
 
     std::atomic<bool> m_show_log_msg{ true };
 };
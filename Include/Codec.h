@@ -0,0 +1,998 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "Protocol.h"
+#include "Utils.h"
+
+// Signal record layout (13 bytes, network byte order / big-endian):
+// uint32_t id
+// uint8_t  type
+// uint64_t value (IEEE 754 double bits)
+
+const size_t SIGNAL_RECORD_SIZE = 4 + 1 + 8;
+
+// Immutable encoded payload. One instance is shared by reference between all sessions
+// that receive the same bytes; only the header (msg_num) differs per session.
+typedef std::shared_ptr<const std::vector<uint8_t>> SharedPayload;
+
+
+inline void encode_signal(const Signal& s, uint8_t* out)
+{
+    // id
+    uint32_t id = host_to_net_u32(s.id);
+    std::memcpy(out, &id, 4);
+
+    // type
+    out[4] = static_cast<uint8_t>(s.type);
+
+    // value
+    uint64_t value;
+    static_assert(sizeof(value) == sizeof(s.value), "double size mismatch");
+    std::memcpy(&value, &s.value, sizeof(value));
+    value = host_to_net_u64(value);
+    std::memcpy(out + 5, &value, 8);
+}
+
+inline void decode_signal(const uint8_t* in, Signal& s)
+{
+    uint32_t id;
+    std::memcpy(&id, in, 4);
+    s.id = net_to_host_u32(id);
+
+    s.type = static_cast<ESignalType>(in[4]);
+
+    uint64_t ubits;
+    std::memcpy(&ubits, in + 5, 8);
+    ubits = net_to_host_u64(ubits);
+    std::memcpy(&s.value, &ubits, sizeof(s.value));
+}
+
+// decode a whole version 1 payload into out (resized once, trailing partial record ignored)
+inline void decode_signals(const uint8_t* data, size_t len, VecSignal& out)
+{
+    const size_t n = len / SIGNAL_RECORD_SIZE;
+    out.resize(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        decode_signal(data + i * SIGNAL_RECORD_SIZE, out[i]);
+        out[i].ts = Signal::time_point();
+    }
+}
+
+// encode all signals matching the type mask
+inline void encode_signals(const VecSignal& signals, uint8_t mask, std::vector<uint8_t>& payload)
+{
+    payload.resize(signals.size() * SIGNAL_RECORD_SIZE);
+
+    size_t pos = 0;
+    for (const auto& s : signals)
+    {
+        if ((uint8_t)s.type & mask)
+        {
+            encode_signal(s, payload.data() + pos);
+            pos += SIGNAL_RECORD_SIZE;
+        }
+    }
+
+    payload.resize(pos);
+}
+
+// Wire format of the data frames of a session, negotiated in the subscribe payload.
+// version 1: fixed 13-byte records (above)
+// version 2: compact payload
+//   uint8_t  flags (V2_FLAG_*)
+//   varint   sequence number (only with V2_FLAG_SEQUENCE): the frame brings the receiver up to this update
+//   varint   record count
+//   varint   id deltas, records sorted by id (first one absolute)
+//   bits     type per record (1 = analog), LSB first
+//   bits     discrete values (only with V2_FLAG_DISCRETE_BITS: all discrete values are 0 / 1)
+//   values   other records in order: float32 analogs (V2_FLAG_FLOAT32) or XOR-delta doubles:
+//            control byte (0: same bits, else 0x80 | leading zero bytes << 4 | trailing zero bytes)
+//            + the remaining bytes, XOR against the previous double of the frame (0 for the first one)
+//   times    only with V2_FLAG_TIMESTAMPS: per record zigzag varint delta of the source time
+//            (wall clock, microseconds since the Unix epoch, 0 = unknown) to the previous record
+
+const uint8_t V2_FLAG_FLOAT32 = 1 << 0;
+const uint8_t V2_FLAG_DISCRETE_BITS = 1 << 1;
+const uint8_t V2_FLAG_TIMESTAMPS = 1 << 2;
+const uint8_t V2_FLAG_SEQUENCE = 1 << 3;
+const uint8_t V2_FLAG_RESET = 1 << 4;       // full state follows: drop the signals held so far
+
+// subscribe options of version 2
+const uint8_t WIRE_OPT_FLOAT32 = 1 << 0;    // analogs may be sent as float32 (lossy)
+const uint8_t WIRE_OPT_TIMESTAMPS = 1 << 1; // records carry their source time
+const uint8_t WIRE_OPT_SEQUENCE = 1 << 2;   // frames carry sequence numbers / reset marks (resumable)
+
+// Position of a data frame in the update stream, encoded only with WIRE_OPT_SEQUENCE.
+// Every accepted update gets the next 64-bit sequence number; a frame tagged with seq leaves the
+// receiver holding every update up to seq. Untagged frames (seq 0) do not move that position.
+struct FrameSeq
+{
+    uint64_t seq = 0;
+    bool reset = false;     // first frame of a full state
+};
+
+struct WireFormat
+{
+    uint8_t version = 1;
+    uint8_t options = 0;    // WIRE_OPT_* (version 2)
+
+    bool operator==(const WireFormat& rhs) const { return version == rhs.version && options == rhs.options; }
+    bool operator!=(const WireFormat& rhs) const { return !(*this == rhs); }
+    bool operator<(const WireFormat& rhs) const { return version != rhs.version ? version < rhs.version : options < rhs.options; }
+};
+
+inline void put_varint(std::vector<uint8_t>& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+inline bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (p == end)
+        {
+            return false;
+        }
+
+        uint8_t b = *p++;
+        v |= uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void put_xor_double(std::vector<uint8_t>& out, double value, uint64_t& prev)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint64_t x = bits ^ prev;
+    prev = bits;
+
+    if (x == 0)
+    {
+        out.push_back(0);
+        return;
+    }
+
+    int lead = 0;
+    while (lead < 7 && !(x >> (56 - 8 * lead) & 0xFF))
+    {
+        lead++;
+    }
+    int trail = count_trailing_zeros_u64(x) / 8;
+
+    out.push_back(static_cast<uint8_t>(0x80 | lead << 4 | trail));
+    for (int i = 7 - lead; i >= trail; i--)
+    {
+        out.push_back(static_cast<uint8_t>(x >> (8 * i)));
+    }
+}
+
+inline bool get_xor_double(const uint8_t*& p, const uint8_t* end, uint64_t& prev, double& value)
+{
+    if (p == end)
+    {
+        return false;
+    }
+
+    uint8_t ctrl = *p++;
+    uint64_t x = 0;
+
+    if (ctrl)
+    {
+        int lead = ctrl >> 4 & 0x07;
+        int trail = ctrl & 0x0F;
+        if (lead + trail > 7 || end - p < 8 - lead - trail)
+        {
+            return false;
+        }
+
+        for (int i = 7 - lead; i >= trail; i--)
+        {
+            x |= uint64_t(*p++) << (8 * i);
+        }
+    }
+
+    prev ^= x;
+    std::memcpy(&value, &prev, sizeof(value));
+    return true;
+}
+
+// Signal::ts (steady_clock) <-> wall clock microseconds, through the current offset of the two clocks.
+// Both ends of a connection convert, so the wire carries a time comparable across processes.
+struct WallClockOffset
+{
+    int64_t steady_to_wall_us;
+
+    WallClockOffset()
+    {
+        using namespace std::chrono;
+        steady_to_wall_us = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count()
+            - duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    int64_t ToWall(Signal::time_point ts) const
+    {
+        using namespace std::chrono;
+        if (ts == Signal::time_point())
+        {
+            return 0;
+        }
+        return duration_cast<microseconds>(ts.time_since_epoch()).count() + steady_to_wall_us;
+    }
+
+    Signal::time_point ToSteady(int64_t wall_us) const
+    {
+        using namespace std::chrono;
+        if (wall_us == 0)
+        {
+            return Signal::time_point();
+        }
+        return Signal::time_point(duration_cast<steady_clock::duration>(microseconds(wall_us - steady_to_wall_us)));
+    }
+};
+
+inline uint64_t zigzag_encode(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t v)
+{
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// encode all signals matching the type mask (version 2), empty payload if none matches
+inline void encode_signals_v2(const VecSignal& signals, uint8_t mask, uint8_t options, std::vector<uint8_t>& payload, const FrameSeq& pos = FrameSeq())
+{
+    payload.clear();
+
+    std::vector<uint32_t> order;
+    order.reserve(signals.size());
+
+    uint8_t flags = V2_FLAG_DISCRETE_BITS;
+    for (uint32_t i = 0; i < signals.size(); i++)
+    {
+        const Signal& s = signals[i];
+        if (!((uint8_t)s.type & mask))
+        {
+            continue;
+        }
+
+        order.push_back(i);
+        if (s.type != ESignalType::analog && s.value != 0.0 && s.value != 1.0)
+        {
+            flags &= ~V2_FLAG_DISCRETE_BITS;
+        }
+    }
+
+    const bool sequenced = (options & WIRE_OPT_SEQUENCE) != 0;
+
+    // a reset is sent even without records: the receiver has to drop its old state
+    if (order.empty() && !(sequenced && pos.reset))
+    {
+        return;
+    }
+
+    if (options & WIRE_OPT_FLOAT32)
+    {
+        flags |= V2_FLAG_FLOAT32;
+    }
+    if (options & WIRE_OPT_TIMESTAMPS)
+    {
+        flags |= V2_FLAG_TIMESTAMPS;
+    }
+    if (sequenced && pos.seq)
+    {
+        flags |= V2_FLAG_SEQUENCE;
+    }
+    if (sequenced && pos.reset)
+    {
+        flags |= V2_FLAG_RESET;
+    }
+
+    // stable: repeated updates of an id keep their order
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return signals[a].id < signals[b].id; });
+
+    const size_t n = order.size();
+    payload.reserve(2 + n * 4);
+    payload.push_back(flags);
+    if (flags & V2_FLAG_SEQUENCE)
+    {
+        put_varint(payload, pos.seq);
+    }
+    put_varint(payload, n);
+
+    uint32_t prev_id = 0;
+    for (uint32_t i : order)
+    {
+        put_varint(payload, signals[i].id - prev_id);
+        prev_id = signals[i].id;
+    }
+
+    size_t pos_types = payload.size();
+    payload.resize(pos_types + (n + 7) / 8, 0);
+
+    size_t cnt_discrete = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+        if (signals[order[k]].type == ESignalType::analog)
+        {
+            payload[pos_types + k / 8] |= uint8_t(1) << (k % 8);
+        }
+        else
+        {
+            cnt_discrete++;
+        }
+    }
+
+    if (flags & V2_FLAG_DISCRETE_BITS)
+    {
+        size_t pos_bits = payload.size();
+        payload.resize(pos_bits + (cnt_discrete + 7) / 8, 0);
+
+        size_t d = 0;
+        for (uint32_t i : order)
+        {
+            if (signals[i].type != ESignalType::analog)
+            {
+                if (signals[i].value != 0.0)
+                {
+                    payload[pos_bits + d / 8] |= uint8_t(1) << (d % 8);
+                }
+                d++;
+            }
+        }
+    }
+
+    uint64_t prev = 0;
+    for (uint32_t i : order)
+    {
+        const Signal& s = signals[i];
+
+        if (s.type == ESignalType::analog && (flags & V2_FLAG_FLOAT32))
+        {
+            float f = static_cast<float>(s.value);
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            bits = host_to_net_u32(bits);
+
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(&bits);
+            payload.insert(payload.end(), p, p + 4);
+        }
+        else if (s.type == ESignalType::analog || !(flags & V2_FLAG_DISCRETE_BITS))
+        {
+            put_xor_double(payload, s.value, prev);
+        }
+    }
+
+    if (flags & V2_FLAG_TIMESTAMPS)
+    {
+        WallClockOffset clock;
+        int64_t prev_us = 0;
+
+        for (uint32_t i : order)
+        {
+            int64_t us = clock.ToWall(signals[i].ts);
+            put_varint(payload, zigzag_encode(us - prev_us));
+            prev_us = us;
+        }
+    }
+}
+
+// decode a version 2 payload, fn(const Signal&) is called per record; false on a malformed payload
+// pos (optional) receives the sequence number / reset mark of the frame
+template <typename Fn>
+bool decode_signals_v2(const uint8_t* data, size_t len, Fn&& fn, FrameSeq* pos = nullptr)
+{
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+
+    if (pos)
+    {
+        *pos = FrameSeq();
+    }
+
+    if (len == 0)
+    {
+        return true;
+    }
+
+    uint8_t flags = *p++;
+
+    uint64_t seq = 0;
+    if ((flags & V2_FLAG_SEQUENCE) && !get_varint(p, end, seq))
+    {
+        return false;
+    }
+
+    if (pos)
+    {
+        pos->seq = seq;
+        pos->reset = (flags & V2_FLAG_RESET) != 0;
+    }
+
+    uint64_t n;
+    if (!get_varint(p, end, n) || n > len * 8)
+    {
+        return false;
+    }
+
+    // ids are needed before the values: decode them in a first pass
+    const uint8_t* p_ids = p;
+    for (uint64_t k = 0; k < n; k++)
+    {
+        uint64_t delta;
+        if (!get_varint(p, end, delta))
+        {
+            return false;
+        }
+    }
+
+    const uint8_t* p_types = p;
+    if ((uint64_t)(end - p) < (n + 7) / 8)
+    {
+        return false;
+    }
+    p += (n + 7) / 8;
+
+    size_t cnt_discrete = 0;
+    for (uint64_t k = 0; k < n; k++)
+    {
+        cnt_discrete += !(p_types[k / 8] >> (k % 8) & 1);
+    }
+
+    const uint8_t* p_bits = p;
+    if (flags & V2_FLAG_DISCRETE_BITS)
+    {
+        if ((size_t)(end - p) < (cnt_discrete + 7) / 8)
+        {
+            return false;
+        }
+        p += (cnt_discrete + 7) / 8;
+    }
+
+    // the times follow the values: locate them by skipping the values first
+    const uint8_t* p_values = p;
+    const uint8_t* p_times = end;
+    WallClockOffset clock;
+
+    if (flags & V2_FLAG_TIMESTAMPS)
+    {
+        uint64_t prev = 0;
+        for (uint64_t k = 0; k < n; k++)
+        {
+            bool analog = p_types[k / 8] >> (k % 8) & 1;
+            if (!analog && (flags & V2_FLAG_DISCRETE_BITS))
+            {
+                continue;
+            }
+
+            double value;
+            if (analog && (flags & V2_FLAG_FLOAT32))
+            {
+                if (end - p < 4)
+                {
+                    return false;
+                }
+                p += 4;
+            }
+            else if (!get_xor_double(p, end, prev, value))
+            {
+                return false;
+            }
+        }
+
+        p_times = p;
+        p = p_values;
+    }
+
+    Signal s;
+    uint64_t id = 0;
+    uint64_t prev = 0;
+    int64_t time_us = 0;
+    size_t d = 0;
+
+    for (uint64_t k = 0; k < n; k++)
+    {
+        uint64_t delta;
+        get_varint(p_ids, end, delta);
+        id += delta;
+
+        s.id = static_cast<uint32_t>(id);
+        bool analog = p_types[k / 8] >> (k % 8) & 1;
+        s.type = analog ? ESignalType::analog : ESignalType::discret;
+
+        if (!analog && (flags & V2_FLAG_DISCRETE_BITS))
+        {
+            s.value = (p_bits[d / 8] >> (d % 8) & 1) ? 1.0 : 0.0;
+            d++;
+        }
+        else if (analog && (flags & V2_FLAG_FLOAT32))
+        {
+            if (end - p < 4)
+            {
+                return false;
+            }
+
+            uint32_t bits;
+            std::memcpy(&bits, p, 4);
+            bits = net_to_host_u32(bits);
+            p += 4;
+
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            s.value = f;
+        }
+        else if (!get_xor_double(p, end, prev, s.value))
+        {
+            return false;
+        }
+
+        if (flags & V2_FLAG_TIMESTAMPS)
+        {
+            uint64_t delta;
+            if (!get_varint(p_times, end, delta))
+            {
+                return false;
+            }
+
+            time_us += zigzag_decode(delta);
+            s.ts = clock.ToSteady(time_us);
+        }
+
+        fn(s);
+    }
+
+    return (flags & V2_FLAG_TIMESTAMPS) ? p_times == end : p == end;
+}
+
+// pos is encoded only by version 2 with WIRE_OPT_SEQUENCE
+inline SharedPayload make_shared_payload(const VecSignal& signals, uint8_t mask, const WireFormat& format = WireFormat(), const FrameSeq& pos = FrameSeq())
+{
+    auto payload = std::make_shared<std::vector<uint8_t>>();
+
+    if (format.version >= 2)
+    {
+        encode_signals_v2(signals, mask, format.options, *payload, pos);
+    }
+    else
+    {
+        encode_signals(signals, mask, *payload);
+    }
+
+    return payload;
+}
+
+inline SSignalProtocolHeader make_header(uint8_t data_type, uint8_t msg_num, uint32_t len, uint8_t version = 1)
+{
+    SSignalProtocolHeader hdr;
+    hdr.signature = host_to_net_u16(SIGNAL_HEADER_SIGNATURE);
+    hdr.version = version;
+    hdr.data_type = data_type;
+    hdr.msg_num = msg_num;
+    hdr.len = host_to_net_u32(len);
+    return hdr;
+}
+
+// Schema change payload (data type 0x04): changes of the signal set a session sees, so live
+// sessions follow SetSignals / AddSignals / RemoveSignals without reconnecting.
+// per entry: uint8_t op (SCHEMA_*) + a version 1 record (removed: last known type, value 0)
+
+const uint8_t SCHEMA_ADDED = 1;
+const uint8_t SCHEMA_REMOVED = 2;
+const uint8_t SCHEMA_RETYPED = 3;   // same id, new type and / or value
+
+const size_t SCHEMA_ENTRY_SIZE = 1 + SIGNAL_RECORD_SIZE;
+
+struct SchemaChange
+{
+    uint8_t op;
+    Signal signal;
+};
+
+typedef std::vector<SchemaChange> VecSchemaChange;
+
+inline SharedPayload make_schema_payload(const VecSchemaChange& changes)
+{
+    auto payload = std::make_shared<std::vector<uint8_t>>(changes.size() * SCHEMA_ENTRY_SIZE);
+
+    uint8_t* out = payload->data();
+    for (const auto& c : changes)
+    {
+        out[0] = c.op;
+        encode_signal(c.signal, out + 1);
+        out += SCHEMA_ENTRY_SIZE;
+    }
+
+    return payload;
+}
+
+// false on a malformed payload
+inline bool decode_schema_payload(const uint8_t* data, size_t len, VecSchemaChange& out)
+{
+    if (len % SCHEMA_ENTRY_SIZE)
+    {
+        return false;
+    }
+
+    out.resize(len / SCHEMA_ENTRY_SIZE);
+
+    for (auto& c : out)
+    {
+        c.op = data[0];
+        if (c.op < SCHEMA_ADDED || c.op > SCHEMA_RETYPED)
+        {
+            return false;
+        }
+
+        decode_signal(data + 1, c.signal);
+        c.signal.ts = Signal::time_point();
+        data += SCHEMA_ENTRY_SIZE;
+    }
+
+    return true;
+}
+
+// State digest: a reconnecting client hashes the signals it holds into buckets by id and sends one
+// digest per bucket; the server resends only the buckets whose digest differs from its own state.
+// Bucket digest: sum of a 64-bit hash of (id, type, value bits) over its signals, so the order of
+// the signals does not matter. Analog values are hashed as the client holds them (float32 option).
+
+const uint32_t DIGEST_BUCKET_SIGNALS = 64;      // signals per bucket the client aims for
+const uint32_t MAX_DIGEST_BUCKETS = 64 * 1024;  // power of two
+
+inline uint64_t mix_u64(uint64_t x)
+{
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+// buckets: power of two
+inline uint32_t digest_bucket(uint32_t id, uint32_t buckets)
+{
+    return static_cast<uint32_t>(mix_u64(id)) & (buckets - 1);
+}
+
+inline uint64_t signal_digest(const Signal& s, uint8_t options = 0)
+{
+    double value = s.value;
+    if (s.type == ESignalType::analog && (options & WIRE_OPT_FLOAT32))
+    {
+        value = static_cast<float>(value);
+    }
+
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    return mix_u64(mix_u64(uint64_t(s.id) << 8 | static_cast<uint8_t>(s.type)) ^ bits);
+}
+
+// power of two for about DIGEST_BUCKET_SIGNALS signals per bucket
+inline uint32_t digest_bucket_count(size_t signals)
+{
+    uint32_t buckets = 1;
+    while (buckets < MAX_DIGEST_BUCKETS && (size_t)buckets * DIGEST_BUCKET_SIGNALS < signals)
+    {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
+inline std::vector<uint64_t> compute_digests(const VecSignal& signals, uint32_t buckets, uint8_t options = 0)
+{
+    std::vector<uint64_t> digests(buckets, 0);
+    for (const auto& s : signals)
+    {
+        digests[digest_bucket(s.id, buckets)] += signal_digest(s, options);
+    }
+    return digests;
+}
+
+// Reconcile payload (data type 0x05), sent ahead of the data frames refilling the resent buckets:
+// uint32_t bucket count, then uint32_t index per resent bucket. The client drops the signals it holds
+// in these buckets; the last data frame after it carries the position (WIRE_OPT_SEQUENCE).
+
+inline SharedPayload make_reconcile_payload(uint32_t buckets, const std::vector<uint32_t>& resent)
+{
+    auto payload = std::make_shared<std::vector<uint8_t>>((1 + resent.size()) * 4);
+
+    uint32_t v = host_to_net_u32(buckets);
+    std::memcpy(payload->data(), &v, 4);
+
+    for (size_t i = 0; i < resent.size(); i++)
+    {
+        v = host_to_net_u32(resent[i]);
+        std::memcpy(payload->data() + (i + 1) * 4, &v, 4);
+    }
+
+    return payload;
+}
+
+// false on a malformed payload
+inline bool decode_reconcile_payload(const uint8_t* data, size_t len, uint32_t& buckets, std::vector<uint32_t>& resent)
+{
+    if (len < 4 || len % 4)
+    {
+        return false;
+    }
+
+    uint32_t v;
+    std::memcpy(&v, data, 4);
+    buckets = net_to_host_u32(v);
+
+    if (buckets == 0 || (buckets & (buckets - 1)) || buckets > MAX_DIGEST_BUCKETS)
+    {
+        return false;
+    }
+
+    resent.resize(len / 4 - 1);
+    for (size_t i = 0; i < resent.size(); i++)
+    {
+        std::memcpy(&v, data + (i + 1) * 4, 4);
+        resent[i] = net_to_host_u32(v);
+        if (resent[i] >= buckets)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// data frame without records that only moves the receiver to seq (version 2, WIRE_OPT_SEQUENCE)
+inline SharedPayload make_position_payload(uint64_t seq)
+{
+    auto payload = std::make_shared<std::vector<uint8_t>>();
+    payload->push_back(V2_FLAG_SEQUENCE);
+    put_varint(*payload, seq);
+    put_varint(*payload, 0);
+    return payload;
+}
+
+// Subscribe payload:
+// uint8_t  type mask
+// optional sections, each: uint8_t tag, uint32_t len, len bytes (unknown tags are skipped)
+//   tag 1 (id ranges): pairs of uint32_t first, uint32_t last (inclusive), at most MAX_ID_RANGES; only these ids are delivered
+//   tag 2 (wire format): uint8_t version, uint8_t options (WIRE_OPT_*); data frames use this version
+//   tag 3 (resume): uint64_t sequence number of the last update held; the server replays only the
+//         later ones if it still has them (else the usual snapshot, starting with V2_FLAG_RESET)
+//   tag 4 (digest): uint32_t bucket count (power of two), uint64_t digest per bucket of the signals
+//         held; the server answers with a reconcile frame and the differing buckets only
+
+const uint8_t SUBSCRIBE_TAG_ID_RANGES = 1;
+const uint8_t SUBSCRIBE_TAG_WIRE_FORMAT = 2;
+const uint8_t SUBSCRIBE_TAG_RESUME = 3;
+const uint8_t SUBSCRIBE_TAG_DIGEST = 4;
+
+const uint8_t MAX_WIRE_VERSION = 2;
+
+const size_t MAX_ID_RANGES = 4096;      // per subscribe, more is a malformed request
+
+struct IdRange
+{
+    uint32_t first;
+    uint32_t last;      // inclusive
+};
+
+typedef std::vector<IdRange> VecIdRange;
+
+struct SubscribeRequest
+{
+    uint8_t mask = 0;
+    bool filter_ids = false;    // false: all ids of the mask
+    VecIdRange id_ranges;
+    WireFormat format;
+    uint64_t resume_seq = 0;    // 0: no resume, send the initial state
+    std::vector<uint64_t> digests;  // per bucket, empty: none
+};
+
+// sort and merge overlapping / adjacent ranges, drop inverted ones
+inline void normalize_id_ranges(VecIdRange& ranges)
+{
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](const IdRange& r) { return r.first > r.last; }), ranges.end());
+    std::sort(ranges.begin(), ranges.end(), [](const IdRange& a, const IdRange& b) { return a.first < b.first; });
+
+    size_t n = 0;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        if (n && (uint64_t)ranges[n - 1].last + 1 >= ranges[i].first)
+        {
+            ranges[n - 1].last = std::max(ranges[n - 1].last, ranges[i].last);
+        }
+        else
+        {
+            ranges[n++] = ranges[i];
+        }
+    }
+    ranges.resize(n);
+}
+
+// ranges must be normalized
+inline bool id_in_ranges(const VecIdRange& ranges, uint32_t id)
+{
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), id, [](uint32_t v, const IdRange& r) { return v < r.first; });
+    return it != ranges.begin() && id <= (it - 1)->last;
+}
+
+inline void append_section(std::vector<uint8_t>& payload, uint8_t tag, const std::vector<uint8_t>& data)
+{
+    payload.push_back(tag);
+
+    uint32_t len = host_to_net_u32(static_cast<uint32_t>(data.size()));
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&len);
+    payload.insert(payload.end(), p, p + 4);
+    payload.insert(payload.end(), data.begin(), data.end());
+}
+
+inline std::vector<uint8_t> encode_subscribe(const SubscribeRequest& req)
+{
+    std::vector<uint8_t> payload;
+    payload.push_back(req.mask);
+
+    if (req.filter_ids)
+    {
+        std::vector<uint8_t> data(req.id_ranges.size() * 8);
+        for (size_t i = 0; i < req.id_ranges.size(); i++)
+        {
+            uint32_t first = host_to_net_u32(req.id_ranges[i].first);
+            uint32_t last = host_to_net_u32(req.id_ranges[i].last);
+            std::memcpy(data.data() + i * 8, &first, 4);
+            std::memcpy(data.data() + i * 8 + 4, &last, 4);
+        }
+        append_section(payload, SUBSCRIBE_TAG_ID_RANGES, data);
+    }
+
+    if (req.format.version != 1)
+    {
+        append_section(payload, SUBSCRIBE_TAG_WIRE_FORMAT, { req.format.version, req.format.options });
+    }
+
+    if (req.resume_seq)
+    {
+        std::vector<uint8_t> data(8);
+        uint64_t seq = host_to_net_u64(req.resume_seq);
+        std::memcpy(data.data(), &seq, 8);
+        append_section(payload, SUBSCRIBE_TAG_RESUME, data);
+    }
+
+    if (!req.digests.empty())
+    {
+        std::vector<uint8_t> data(4 + req.digests.size() * 8);
+        uint32_t buckets = host_to_net_u32(static_cast<uint32_t>(req.digests.size()));
+        std::memcpy(data.data(), &buckets, 4);
+
+        for (size_t i = 0; i < req.digests.size(); i++)
+        {
+            uint64_t digest = host_to_net_u64(req.digests[i]);
+            std::memcpy(data.data() + 4 + i * 8, &digest, 8);
+        }
+        append_section(payload, SUBSCRIBE_TAG_DIGEST, data);
+    }
+
+    return payload;
+}
+
+// false on a malformed payload
+inline bool decode_subscribe(const std::vector<uint8_t>& payload, SubscribeRequest& req)
+{
+    if (payload.empty())
+    {
+        return false;
+    }
+
+    req = SubscribeRequest();
+    req.mask = payload[0];
+
+    size_t pos = 1;
+    while (pos < payload.size())
+    {
+        if (pos + 5 > payload.size())
+        {
+            return false;
+        }
+
+        uint8_t tag = payload[pos];
+        uint32_t len;
+        std::memcpy(&len, payload.data() + pos + 1, 4);
+        len = net_to_host_u32(len);
+        pos += 5;
+
+        if (len > payload.size() - pos)
+        {
+            return false;
+        }
+
+        const uint8_t* data = payload.data() + pos;
+
+        if (tag == SUBSCRIBE_TAG_ID_RANGES)
+        {
+            if (len % 8 || len / 8 > MAX_ID_RANGES)
+            {
+                return false;
+            }
+
+            req.filter_ids = true;
+            for (size_t i = 0; i < len; i += 8)
+            {
+                uint32_t first, last;
+                std::memcpy(&first, data + i, 4);
+                std::memcpy(&last, data + i + 4, 4);
+                req.id_ranges.push_back({ net_to_host_u32(first), net_to_host_u32(last) });
+            }
+            normalize_id_ranges(req.id_ranges);
+        }
+        else if (tag == SUBSCRIBE_TAG_WIRE_FORMAT)
+        {
+            if (len < 2 || data[0] == 0 || data[0] > MAX_WIRE_VERSION)
+            {
+                return false;
+            }
+
+            req.format.version = data[0];
+            req.format.options = data[1];
+        }
+        else if (tag == SUBSCRIBE_TAG_RESUME)
+        {
+            if (len < 8)
+            {
+                return false;
+            }
+
+            uint64_t seq;
+            std::memcpy(&seq, data, 8);
+            req.resume_seq = net_to_host_u64(seq);
+        }
+        else if (tag == SUBSCRIBE_TAG_DIGEST)
+        {
+            if (len < 4)
+            {
+                return false;
+            }
+
+            uint32_t buckets;
+            std::memcpy(&buckets, data, 4);
+            buckets = net_to_host_u32(buckets);
+
+            if (buckets == 0 || (buckets & (buckets - 1)) || buckets > MAX_DIGEST_BUCKETS || len != 4 + (size_t)buckets * 8)
+            {
+                return false;
+            }
+
+            req.digests.resize(buckets);
+            for (uint32_t i = 0; i < buckets; i++)
+            {
+                uint64_t digest;
+                std::memcpy(&digest, data + 4 + i * 8, 8);
+                req.digests[i] = net_to_host_u64(digest);
+            }
+        }
+
+        pos += len;
+    }
+
+    return true;
+}
@@ -9,7 +9,7 @@
 // Header layout (9 bytes, network byte order / big-endian):
 // uint16_t signature (0xAA55)
 // uint8_t  version (1)
-// uint8_t  dataType (1=Subscribe (to server), 2=Data (to client), 3=Alive (to client))
+// uint8_t  dataType (1=Subscribe (to server), 2=Data (to client), 3=Alive (to client), 4=Schema change (to client), 5=Reconcile (to client))
 // uint8_t  msg_num (order msg number)
 // uint32_t len (payload length)
 
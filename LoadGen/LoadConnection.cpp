@@ -0,0 +1,200 @@
+// LoadConnection.cpp
+
+#include "LoadConnection.h"
+#include <Utils.h>
+#include <cstring>
+#include <algorithm>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using error_code = boost::system::error_code;
+using steady_clock = std::chrono::steady_clock;
+
+
+LoadConnection::LoadConnection(asio::io_context& io, const tcp::endpoint& endpoint,
+    const SubscribeRequest& request, Histogram& latency, const std::atomic<int64_t>& measure_from)
+    : m_socket(io), m_endpoint(endpoint), m_latency(latency), m_measure_from(measure_from)
+{
+    std::vector<uint8_t> payload = encode_subscribe(request);
+    SSignalProtocolHeader hdr = make_header(0x01, 0, static_cast<uint32_t>(payload.size()));
+
+    m_subscribe.resize(sizeof(hdr) + payload.size());
+    std::memcpy(m_subscribe.data(), &hdr, sizeof(hdr));
+    std::memcpy(m_subscribe.data() + sizeof(hdr), payload.data(), payload.size());
+}
+
+void LoadConnection::Start()
+{
+    m_socket.async_connect(m_endpoint, [this](error_code ec)
+        {
+            if (ec)
+            {
+                fail();
+                return;
+            }
+
+            error_code ec_opt;
+            m_socket.set_option(tcp::no_delay(true), ec_opt);
+
+            asio::async_write(m_socket, asio::buffer(m_subscribe), [this](error_code ec, std::size_t /*n*/)
+                {
+                    if (ec)
+                    {
+                        fail();
+                        return;
+                    }
+
+                    m_subscribed.store(true, std::memory_order_relaxed);
+                    start_read();
+                });
+        });
+}
+
+void LoadConnection::Stop()
+{
+    asio::post(m_socket.get_executor(), [this]()
+        {
+            error_code ec;
+            m_socket.shutdown(tcp::socket::shutdown_both, ec);
+            m_socket.close(ec);
+        });
+}
+
+void LoadConnection::fail()
+{
+    m_failed.store(true, std::memory_order_relaxed);
+
+    error_code ec;
+    m_socket.close(ec);
+}
+
+void LoadConnection::start_read()
+{
+    // keep room for a large read: move the partial frame to the front, grow only for a bigger frame
+    if (m_rx.size() - m_rx_end < RX_MIN_READ)
+    {
+        std::memmove(m_rx.data(), m_rx.data() + m_rx_begin, m_rx_end - m_rx_begin);
+        m_rx_end -= m_rx_begin;
+        m_rx_begin = 0;
+
+        if (m_rx.size() - m_rx_end < RX_MIN_READ)
+        {
+            m_rx.resize(m_rx_end + RX_MIN_READ);
+        }
+    }
+
+    m_socket.async_read_some(asio::buffer(m_rx.data() + m_rx_end, m_rx.size() - m_rx_end), [this](error_code ec, std::size_t n)
+        {
+            if (ec)
+            {
+                if (ec != asio::error::operation_aborted && ec != asio::error::bad_descriptor)
+                {
+                    fail();
+                }
+                return;
+            }
+
+            m_rx_end += n;
+
+            if (parse_frames())
+            {
+                start_read();
+            }
+        });
+}
+
+bool LoadConnection::parse_frames()
+{
+    // every complete frame of the buffer, in one completion
+    while (m_rx_end - m_rx_begin >= sizeof(SSignalProtocolHeader))
+    {
+        SSignalProtocolHeader hdr;
+        std::memcpy(&hdr, m_rx.data() + m_rx_begin, sizeof(hdr));
+
+        uint32_t len = net_to_host_u32(hdr.len);
+        if (net_to_host_u16(hdr.signature) != SIGNAL_HEADER_SIGNATURE || len > 10 * 1024 * 1024)
+        {
+            fail();
+            return false;
+        }
+
+        if (m_rx_end - m_rx_begin < sizeof(hdr) + len)
+        {
+            // partial frame: make sure the buffer can hold all of it
+            if (m_rx.size() - m_rx_begin < sizeof(hdr) + len + RX_MIN_READ)
+            {
+                m_rx.resize(m_rx_begin + sizeof(hdr) + len + RX_MIN_READ);
+            }
+            break;
+        }
+
+        if (hdr.data_type == 0x02)
+        {
+            process_records(hdr, m_rx.data() + m_rx_begin + sizeof(hdr), len);
+        }
+
+        m_rx_begin += sizeof(hdr) + len;
+    }
+
+    if (m_rx_begin == m_rx_end)
+    {
+        m_rx_begin = m_rx_end = 0;
+    }
+
+    return true;
+}
+
+void LoadConnection::process_records(const SSignalProtocolHeader& hdr, const uint8_t* body, size_t len)
+{
+    if (hdr.version < 2)
+    {
+        // version 1 records carry no source time nor sequence number
+        if (m_measure_from.load(std::memory_order_relaxed) != 0)
+        {
+            m_updates.fetch_add(len / SIGNAL_RECORD_SIZE, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    const int64_t from = m_measure_from.load(std::memory_order_relaxed);
+    const auto now = steady_clock::now();
+    uint64_t updates = 0;
+    uint64_t last = 0;
+    uint64_t max = m_max_latency.load(std::memory_order_relaxed);
+    int64_t newest = m_newest_ts.load(std::memory_order_relaxed);
+
+    auto record = [&](const Signal& s)
+        {
+            const int64_t ts = s.ts.time_since_epoch().count();
+            newest = std::max(newest, ts);
+
+            // the snapshot and updates pushed before the start carry older source times
+            if (from == 0 || ts < from)
+            {
+                return;
+            }
+
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - s.ts).count();
+            last = us > 0 ? static_cast<uint64_t>(us) : 0;
+
+            m_latency.Record(last);
+            max = std::max(max, last);
+            updates++;
+        };
+
+    FrameSeq pos;
+    decode_signals_v2(body, len, record, &pos);
+
+    if (pos.seq > m_last_seq.load(std::memory_order_relaxed))
+    {
+        m_last_seq.store(pos.seq, std::memory_order_relaxed);
+    }
+    m_newest_ts.store(newest, std::memory_order_relaxed);
+
+    if (updates)
+    {
+        m_updates.fetch_add(updates, std::memory_order_relaxed);
+        m_last_latency.store(last, std::memory_order_relaxed);
+        m_max_latency.store(max, std::memory_order_relaxed);
+    }
+}
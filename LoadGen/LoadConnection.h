@@ -0,0 +1,71 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <Protocol.h>
+#include <Codec.h>
+#include <Histogram.h>
+#include <array>
+#include <atomic>
+#include <vector>
+
+
+// Lightweight subscriber for load generation: no reconnects, no signal map, no logging.
+// Records received with a source time at or after the measurement start are counted and
+// their delivery latency goes to the shared histogram. The position in the update stream
+// (sequence number, newest source time) tells how far the connection is behind.
+class LoadConnection
+{
+public:
+    LoadConnection(boost::asio::io_context& io, const boost::asio::ip::tcp::endpoint& endpoint,
+        const SubscribeRequest& request, Histogram& latency, const std::atomic<int64_t>& measure_from);
+
+    // disable copying
+    LoadConnection(const LoadConnection&) = delete;
+    LoadConnection& operator=(const LoadConnection&) = delete;
+
+    void Start();
+    void Stop();    // any thread
+
+    bool IsSubscribed() const { return m_subscribed.load(std::memory_order_relaxed); }
+    bool IsFailed() const { return m_failed.load(std::memory_order_relaxed); }
+
+    // measured records (relaxed, readable while running)
+    uint64_t GetUpdates() const { return m_updates.load(std::memory_order_relaxed); }
+    uint64_t GetLastLatency() const { return m_last_latency.load(std::memory_order_relaxed); }     // microseconds, of the last record
+    uint64_t GetMaxLatency() const { return m_max_latency.load(std::memory_order_relaxed); }
+
+    // position: sequence number of the last update received (WIRE_OPT_SEQUENCE), newest source time (steady ticks)
+    uint64_t GetLastSequence() const { return m_last_seq.load(std::memory_order_relaxed); }
+    int64_t GetNewestTime() const { return m_newest_ts.load(std::memory_order_relaxed); }
+
+private:
+    void start_read();
+    bool parse_frames();
+    void process_records(const SSignalProtocolHeader& hdr, const uint8_t* body, size_t len);
+    void fail();
+
+private:
+    boost::asio::ip::tcp::socket m_socket;
+    boost::asio::ip::tcp::endpoint m_endpoint;
+
+    std::vector<uint8_t> m_subscribe;       // whole frame
+
+    // frames are parsed in place from m_rx[m_rx_begin, m_rx_end), filled by async_read_some
+    // (smaller than the Client's: there are thousands of these)
+    static const size_t RX_MIN_READ = 16 * 1024;
+
+    std::vector<uint8_t> m_rx = std::vector<uint8_t>(2 * RX_MIN_READ);
+    size_t m_rx_begin{ 0 };
+    size_t m_rx_end{ 0 };
+
+    Histogram& m_latency;
+    const std::atomic<int64_t>& m_measure_from;     // steady ticks, 0: not measuring yet
+
+    std::atomic<bool> m_subscribed{ false };
+    std::atomic<bool> m_failed{ false };
+    std::atomic<uint64_t> m_updates{ 0 };
+    std::atomic<uint64_t> m_last_latency{ 0 };
+    std::atomic<uint64_t> m_max_latency{ 0 };
+    std::atomic<uint64_t> m_last_seq{ 0 };
+    std::atomic<int64_t> m_newest_ts{ 0 };
+};
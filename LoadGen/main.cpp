@@ -0,0 +1,458 @@
+#include "LoadConnection.h"
+#include <Server.h>
+#include <IoPool.h>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using steady_clock = std::chrono::steady_clock;
+
+
+// usage: LoadGen [--option value] ...
+//  --host      remote server (default: embedded server on a free port)
+//  --port      remote server port (default 5000)
+//  --clients   connections (default 1000)
+//  --threads   io threads of the connections (default 2)
+//  --server-threads  io threads of the embedded server (default 2)
+//  --signals   signal count of the embedded server (default 10000)
+//  --rate      updates per second pushed into the embedded server (default 100000)
+//  --dist      id distribution of the pushed updates: uniform | zipf | hot (10% of the ids get 90% of the updates)
+//  --duration  measurement, seconds (default 10)
+//  --mask      subscribed types: 1 discrete, 2 analog, 3 both (default 3)
+//  --float32   1: request float32 analogs
+//  --report    csv | json (default csv)
+//  --out       report file (default stdout)
+//  --per-client 1: one report row per connection
+// A remote server is only subscribed to: its updates come from its own ingestion.
+// Lag is taken when the updates stop: per connection, the updates and the source time between
+// the newest update (the server's sequence number and last push; for a remote server the most
+// advanced connection) and the last one the connection received.
+struct Options
+{
+    std::string host;
+    uint16_t port = 5000;
+    size_t clients = 1000;
+    size_t threads = 2;
+    size_t server_threads = 2;
+    uint32_t signals = 10000;
+    double rate = 100000;
+    std::string dist = "uniform";
+    double duration = 10;
+    uint8_t mask = 3;
+    bool float32 = false;
+    std::string report = "csv";
+    std::string out;
+    bool per_client = false;
+};
+
+static bool parse_options(int argc, char* argv[], Options& opt)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+
+        if (key == "--host") opt.host = value;
+        else if (key == "--port") opt.port = static_cast<uint16_t>(std::atoi(value.c_str()));
+        else if (key == "--clients") opt.clients = std::strtoul(value.c_str(), nullptr, 10);
+        else if (key == "--threads") opt.threads = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+        else if (key == "--server-threads") opt.server_threads = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+        else if (key == "--signals") opt.signals = std::max<uint32_t>(1, static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10)));
+        else if (key == "--rate") opt.rate = std::atof(value.c_str());
+        else if (key == "--dist") opt.dist = value;
+        else if (key == "--duration") opt.duration = std::atof(value.c_str());
+        else if (key == "--mask") opt.mask = static_cast<uint8_t>(std::atoi(value.c_str()));
+        else if (key == "--float32") opt.float32 = std::atoi(value.c_str()) != 0;
+        else if (key == "--report") opt.report = value;
+        else if (key == "--out") opt.out = value;
+        else if (key == "--per-client") opt.per_client = std::atoi(value.c_str()) != 0;
+        else
+        {
+            std::cerr << "Unknown option " << key << "\n";
+            return false;
+        }
+    }
+
+    if (opt.dist != "uniform" && opt.dist != "zipf" && opt.dist != "hot")
+    {
+        std::cerr << "Unknown distribution " << opt.dist << "\n";
+        return false;
+    }
+
+    if (opt.report != "csv" && opt.report != "json")
+    {
+        std::cerr << "Unknown report format " << opt.report << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+// ids 1..n drawn from the configured distribution
+class IdGenerator
+{
+public:
+    IdGenerator(const std::string& dist, uint32_t n)
+        : m_dist(dist), m_n(n), m_uniform(1, n), m_hot(1, std::max<uint32_t>(1, n / 10))
+    {
+        if (m_dist == "zipf")
+        {
+            // cumulative weights 1/k
+            m_cdf.resize(n);
+            double sum = 0;
+            for (uint32_t k = 1; k <= n; k++)
+            {
+                sum += 1.0 / k;
+                m_cdf[k - 1] = sum;
+            }
+            for (auto& c : m_cdf)
+            {
+                c /= sum;
+            }
+        }
+    }
+
+    uint32_t Next()
+    {
+        if (m_dist == "zipf")
+        {
+            double u = m_real(m_rng);
+            return static_cast<uint32_t>(std::lower_bound(m_cdf.begin(), m_cdf.end(), u) - m_cdf.begin()) + 1;
+        }
+
+        if (m_dist == "hot" && m_real(m_rng) < 0.9)
+        {
+            return m_hot(m_rng);
+        }
+
+        return m_uniform(m_rng);
+    }
+
+private:
+    std::string m_dist;
+    uint32_t m_n;
+    std::mt19937 m_rng{ 12345 };
+    std::uniform_int_distribution<uint32_t> m_uniform;
+    std::uniform_int_distribution<uint32_t> m_hot;
+    std::uniform_real_distribution<double> m_real{ 0.0, 1.0 };
+    std::vector<double> m_cdf;
+};
+
+
+// pushes opt.rate updates per second in 1 ms blocks until stop; newest: source time of the last block
+static uint64_t drive_updates(Server& server, const Options& opt, const std::atomic<bool>& stop, std::atomic<int64_t>& newest)
+{
+    IdGenerator ids(opt.dist, opt.signals);
+    std::vector<double> values(opt.signals + 1, 0.0);
+
+    VecSignal block;
+    uint64_t pushed = 0;
+    const auto start = steady_clock::now();
+
+    while (!stop)
+    {
+        const auto now = steady_clock::now();
+        const double elapsed = std::chrono::duration<double>(now - start).count();
+        const uint64_t due = static_cast<uint64_t>(elapsed * opt.rate);
+
+        block.clear();
+        for (; pushed + block.size() < due; )
+        {
+            uint32_t id = ids.Next();
+            bool analog = (id % 2) != 0;
+            values[id] = analog ? values[id] + 0.25 : double(1 - int(values[id]));
+            block.emplace_back(id, analog ? ESignalType::analog : ESignalType::discret, values[id], now);
+        }
+
+        if (!block.empty())
+        {
+            server.PushSignals(block);
+            pushed += block.size();
+            newest.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return pushed;
+}
+
+
+// how far a connection is behind the newest update
+struct Lag
+{
+    uint64_t updates = 0;
+    uint64_t us = 0;
+};
+
+struct Report
+{
+    double seconds = 0;
+    uint64_t pushed = 0;
+    uint64_t received = 0;
+    size_t connected = 0;
+    size_t failed = 0;
+    uint64_t p50 = 0, p99 = 0, p999 = 0, max = 0;
+    Lag max_lag;
+    std::vector<Lag> lags;      // per connection
+};
+
+static void write_report(std::ostream& out, const Options& opt, const Report& r, const std::vector<std::unique_ptr<LoadConnection>>& connections)
+{
+    const double push_rate = r.seconds > 0 ? r.pushed / r.seconds : 0;
+    const double delivery_rate = r.seconds > 0 ? r.received / r.seconds : 0;
+
+    if (opt.report == "json")
+    {
+        out << "{\n"
+            << "  \"clients\": " << opt.clients << ",\n"
+            << "  \"connected\": " << r.connected << ",\n"
+            << "  \"failed\": " << r.failed << ",\n"
+            << "  \"seconds\": " << r.seconds << ",\n"
+            << "  \"updates_pushed\": " << r.pushed << ",\n"
+            << "  \"updates_received\": " << r.received << ",\n"
+            << "  \"push_rate\": " << push_rate << ",\n"
+            << "  \"delivery_rate\": " << delivery_rate << ",\n"
+            << "  \"latency_us\": { \"p50\": " << r.p50 << ", \"p99\": " << r.p99 << ", \"p99_9\": " << r.p999 << ", \"max\": " << r.max << " },\n"
+            << "  \"lag_max\": { \"updates\": " << r.max_lag.updates << ", \"us\": " << r.max_lag.us << " }";
+
+        if (opt.per_client)
+        {
+            out << ",\n  \"per_client\": [\n";
+            for (size_t i = 0; i < connections.size(); i++)
+            {
+                const auto& c = *connections[i];
+                out << "    { \"client\": " << i << ", \"updates\": " << c.GetUpdates() << ", \"lag_updates\": " << r.lags[i].updates
+                    << ", \"lag_us\": " << r.lags[i].us << ", \"last_latency_us\": " << c.GetLastLatency()
+                    << ", \"max_latency_us\": " << c.GetMaxLatency() << " }" << (i + 1 < connections.size() ? ",\n" : "\n");
+            }
+            out << "  ]";
+        }
+        out << "\n}\n";
+        return;
+    }
+
+    out << "metric,value\n"
+        << "clients," << opt.clients << "\n"
+        << "connected," << r.connected << "\n"
+        << "failed," << r.failed << "\n"
+        << "seconds," << r.seconds << "\n"
+        << "updates_pushed," << r.pushed << "\n"
+        << "updates_received," << r.received << "\n"
+        << "push_rate," << push_rate << "\n"
+        << "delivery_rate," << delivery_rate << "\n"
+        << "latency_p50_us," << r.p50 << "\n"
+        << "latency_p99_us," << r.p99 << "\n"
+        << "latency_p99_9_us," << r.p999 << "\n"
+        << "latency_max_us," << r.max << "\n"
+        << "lag_max_updates," << r.max_lag.updates << "\n"
+        << "lag_max_us," << r.max_lag.us << "\n";
+
+    if (opt.per_client)
+    {
+        out << "\nclient,updates,lag_updates,lag_us,last_latency_us,max_latency_us\n";
+        for (size_t i = 0; i < connections.size(); i++)
+        {
+            const auto& c = *connections[i];
+            out << i << "," << c.GetUpdates() << "," << r.lags[i].updates << "," << r.lags[i].us << ","
+                << c.GetLastLatency() << "," << c.GetMaxLatency() << "\n";
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        Options opt;
+        if (!parse_options(argc, argv, opt))
+        {
+            return 1;
+        }
+
+        // embedded server
+        std::unique_ptr<IoPool> server_pool;
+        std::unique_ptr<Server> server;
+        tcp::endpoint endpoint;
+
+        if (opt.host.empty())
+        {
+            server_pool = std::make_unique<IoPool>(opt.server_threads);
+            server = std::make_unique<Server>(*server_pool, 0);
+            server->EnableDataEmulation(false);
+            server->EnableShowLogMsg(false);
+
+            VecSignal signals;
+            for (uint32_t id = 1; id <= opt.signals; id++)
+            {
+                signals.emplace_back(id, (id % 2) ? ESignalType::analog : ESignalType::discret, 0.0);
+            }
+            server->SetSignalsAndWait(signals);
+            server->Start();
+            server_pool->Run();
+
+            endpoint = tcp::endpoint(asio::ip::address_v4::loopback(), server->GetPort());
+        }
+        else
+        {
+            asio::io_context io;
+            tcp::resolver resolver(io);
+            endpoint = *resolver.resolve(opt.host, std::to_string(opt.port)).begin();
+        }
+
+        // connections
+        IoPool pool(opt.threads);
+        Histogram latency;
+        std::atomic<int64_t> measure_from{ 0 };
+
+        SubscribeRequest req;
+        req.mask = opt.mask;
+        req.format.version = 2;
+        req.format.options = WIRE_OPT_TIMESTAMPS | WIRE_OPT_SEQUENCE | (opt.float32 ? WIRE_OPT_FLOAT32 : 0);
+
+        std::vector<std::unique_ptr<LoadConnection>> connections;
+        connections.reserve(opt.clients);
+        for (size_t i = 0; i < opt.clients; i++)
+        {
+            connections.emplace_back(std::make_unique<LoadConnection>(pool.Get(i % pool.Size()), endpoint, req, latency, measure_from));
+        }
+
+        for (auto& c : connections)
+        {
+            asio::post(pool.Get(0), [&c]() { c->Start(); });
+        }
+        pool.Run();
+
+        // wait until every connection subscribed or failed
+        const auto connect_start = steady_clock::now();
+        size_t connected = 0, failed = 0;
+        while (steady_clock::now() - connect_start < std::chrono::seconds(30))
+        {
+            connected = failed = 0;
+            for (const auto& c : connections)
+            {
+                connected += c->IsSubscribed();
+                failed += c->IsFailed();
+            }
+            if (connected + failed >= connections.size())
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        std::cerr << "LoadGen: " << connected << " of " << opt.clients << " connections subscribed, " << failed << " failed\n";
+
+        // measurement
+        std::atomic<bool> stop{ false };
+        uint64_t pushed = 0;
+        std::atomic<int64_t> newest_pushed{ 0 };
+        std::thread producer;
+
+        const auto start = steady_clock::now();
+        measure_from = start.time_since_epoch().count();
+
+        if (server)
+        {
+            producer = std::thread([&]() { pushed = drive_updates(*server, opt, stop, newest_pushed); });
+        }
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(opt.duration));
+        stop = true;
+
+        if (producer.joinable())
+        {
+            producer.join();
+        }
+
+        // lag, before the deliveries in flight catch up: against the newest update taken by the server
+        // (a remote one: the most advanced connection)
+        uint64_t newest_seq = server ? server->GetSequence() : 0;
+        int64_t newest_ts = newest_pushed;
+
+        std::vector<std::pair<uint64_t, int64_t>> positions;
+        positions.reserve(connections.size());
+        for (const auto& c : connections)
+        {
+            positions.emplace_back(c->GetLastSequence(), c->GetNewestTime());
+            if (!server)
+            {
+                newest_seq = std::max(newest_seq, positions.back().first);
+                newest_ts = std::max(newest_ts, positions.back().second);
+            }
+        }
+
+        Report r;
+        for (const auto& p : positions)
+        {
+            Lag lag;
+            lag.updates = p.first && newest_seq > p.first ? newest_seq - p.first : 0;
+            if (p.second && newest_ts > p.second)
+            {
+                lag.us = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::duration(newest_ts - p.second)).count();
+            }
+
+            r.max_lag.updates = std::max(r.max_lag.updates, lag.updates);
+            r.max_lag.us = std::max(r.max_lag.us, lag.us);
+            r.lags.push_back(lag);
+        }
+
+        // deliveries still in flight
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        r.seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+        r.pushed = pushed;
+        r.connected = connected;
+        for (const auto& c : connections)
+        {
+            r.received += c->GetUpdates();
+            r.failed += c->IsFailed();
+        }
+        r.p50 = latency.Percentile(50);
+        r.p99 = latency.Percentile(99);
+        r.p999 = latency.Percentile(99.9);
+        r.max = latency.Max();
+
+        for (auto& c : connections)
+        {
+            c->Stop();
+        }
+        pool.Stop();
+
+        if (server)
+        {
+            server_pool->Stop();
+            server->Stop();
+        }
+
+        if (opt.out.empty())
+        {
+            write_report(std::cout, opt, r, connections);
+        }
+        else
+        {
+            std::ofstream file(opt.out);
+            write_report(file, opt, r, connections);
+        }
+    }
+    catch (std::exception& ex)
+    {
+        std::cerr << ex.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
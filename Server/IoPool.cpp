@@ -0,0 +1,99 @@
+// IoPool.cpp
+
+#include "IoPool.h"
+#include <iostream>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+static void pin_thread(std::thread& th, size_t core)
+{
+#if defined(_WIN32)
+    SetThreadAffinityMask(th.native_handle(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+
+    if (pthread_setaffinity_np(th.native_handle(), sizeof(set), &set) != 0)
+    {
+        std::cerr << "IoPool: can't pin thread to core " << core << "\n";
+    }
+#else
+    (void)th;
+    (void)core;
+#endif
+}
+
+
+IoPool::IoPool(size_t size, bool pin_threads)
+    : m_pin_threads(pin_threads)
+{
+    if (size == 0)
+    {
+        size = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        // each context is run by exactly one thread
+        m_contexts.emplace_back(std::make_unique<boost::asio::io_context>(1));
+        m_work_guards.emplace_back(boost::asio::make_work_guard(*m_contexts.back()));
+    }
+}
+
+IoPool::~IoPool()
+{
+    Stop();
+}
+
+void IoPool::Run()
+{
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < m_contexts.size(); i++)
+    {
+        auto& io = *m_contexts[i];
+        m_threads.emplace_back([&io]() { io.run(); });
+
+        if (m_pin_threads)
+        {
+            pin_thread(m_threads.back(), i % cores);
+        }
+    }
+}
+
+void IoPool::Join()
+{
+    for (auto& th : m_threads)
+    {
+        if (th.joinable())
+        {
+            th.join();
+        }
+    }
+    m_threads.clear();
+}
+
+void IoPool::Stop()
+{
+    m_work_guards.clear();
+
+    for (auto& io : m_contexts)
+    {
+        io->stop();
+    }
+
+    Join();
+}
+
+boost::asio::io_context& IoPool::Next()
+{
+    return *m_contexts[m_next.fetch_add(1, std::memory_order_relaxed) % m_contexts.size()];
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+
+// Pool of io_contexts, each run by its own thread (optionally pinned to a core).
+// Sessions are spread over the contexts, so their strands run in parallel.
+class IoPool
+{
+public:
+    // size 0: one io_context per hardware thread
+    explicit IoPool(size_t size = 0, bool pin_threads = false);
+    ~IoPool();
+
+    // disable copying
+    IoPool(const IoPool&) = delete;
+    IoPool& operator=(const IoPool&) = delete;
+
+    void Run();     // start the threads
+    void Join();    // wait until the threads finish
+    void Stop();    // stop the contexts and join the threads
+
+    size_t Size() const { return m_contexts.size(); }
+    boost::asio::io_context& Get(size_t i) { return *m_contexts[i]; }
+    boost::asio::io_context& Next();    // round-robin
+
+private:
+    using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> m_contexts;
+    std::vector<WorkGuard> m_work_guards;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_next{ 0 };
+    bool m_pin_threads;
+};
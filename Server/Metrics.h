@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+// Counter split over cache-line sized shards: a thread adds to the shard picked on its first use
+// (relaxed, no shared cache line with other threads), readers sum all shards.
+class ShardedCounter
+{
+public:
+    static const size_t SHARDS = 8;
+
+    void Add(uint64_t n = 1)
+    {
+        m_shards[shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t Value() const
+    {
+        uint64_t sum = 0;
+        for (const auto& s : m_shards)
+        {
+            sum += s.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    static size_t shard()
+    {
+        static std::atomic<size_t> next{ 0 };
+        thread_local size_t index = next++ % SHARDS;
+        return index;
+    }
+
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> value{ 0 };
+    };
+
+    Shard m_shards[SHARDS];
+};
+
+
+// server-wide counters (monotonic)
+struct ServerCounters
+{
+    ShardedCounter updates_ingested;    // accepted by PushSignal / PushSignals
+    ShardedCounter updates_dropped;     // rejected: unknown id or older than the stored value
+    ShardedCounter updates_conflated;   // replaced by a newer value before dispatch (EIngestMode::conflate)
+    ShardedCounter batches;             // dispatcher batches
+    ShardedCounter batch_updates;       // updates in dispatcher batches
+    ShardedCounter frames_sent;
+    ShardedCounter bytes_sent;
+    ShardedCounter sessions_accepted;
+    ShardedCounter sessions_closed;
+    ShardedCounter slow_consumer_events;    // sessions switched to conflation
+    ShardedCounter snapshots_built;         // initial state frames encoded
+    ShardedCounter snapshots_shared;        // subscribers served from a cached frame
+    ShardedCounter resumes;                 // resuming subscribers served from the replay ring
+    ShardedCounter resume_misses;           // resuming subscribers that got the initial state instead
+    ShardedCounter reconciles;              // subscribers synchronized by bucket digests
+    ShardedCounter reconcile_buckets_resent;
+};
@@ -0,0 +1,199 @@
+// MetricsListener.cpp
+
+#include "MetricsListener.h"
+#include <Utils.h>
+#include <mutex>
+#include <set>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using error_code = boost::system::error_code;
+
+
+// a client that has not sent its request by then is dropped
+static const std::chrono::seconds REQUEST_TIMEOUT(5);
+
+
+struct MetricsListener::Connection
+{
+    explicit Connection(tcp::socket s) : socket(std::move(s)), timer(socket.get_executor()), request(16 * 1024) {}
+
+    // on the connection's strand
+    void close()
+    {
+        error_code ec;
+        timer.cancel();
+        socket.shutdown(tcp::socket::shutdown_both, ec);
+        socket.close(ec);
+    }
+
+    tcp::socket socket;             // on its own strand, as its timer
+    asio::steady_timer timer;
+    asio::streambuf request;
+    std::string response;
+};
+
+struct MetricsListener::State
+{
+    State(asio::io_context& io, Render render) : io(io), acceptor(io), render(std::move(render)) {}
+
+    asio::io_context& io;
+    tcp::acceptor acceptor;
+
+    std::mutex mtx;                 // render is called under it, so Stop() waits for a scrape in progress
+    Render render;
+    bool stopped{ false };
+    std::set<std::shared_ptr<Connection>> connections;
+};
+
+
+MetricsListener::MetricsListener(asio::io_context& io, uint16_t port, Render render)
+    : m_state(std::make_shared<State>(io, std::move(render)))
+{
+    // local scraping only
+    tcp::endpoint endpoint(asio::ip::address_v4::loopback(), port);
+
+    tcp::acceptor& acceptor = m_state->acceptor;
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+}
+
+MetricsListener::~MetricsListener()
+{
+    Stop();
+}
+
+void MetricsListener::Start()
+{
+    do_accept(m_state);
+}
+
+void MetricsListener::Stop()
+{
+    std::set<std::shared_ptr<Connection>> connections;
+    {
+        std::lock_guard<std::mutex> lk(m_state->mtx);
+
+        m_state->stopped = true;
+        m_state->render = nullptr;      // releases what the callback captured
+        connections.swap(m_state->connections);
+    }
+
+    error_code ec;
+    m_state->acceptor.close(ec);
+
+    for (const auto& conn : connections)
+    {
+        asio::post(conn->socket.get_executor(), [conn]() { conn->close(); });
+    }
+}
+
+uint16_t MetricsListener::GetPort() const
+{
+    error_code ec;
+    return m_state->acceptor.local_endpoint(ec).port();
+}
+
+void MetricsListener::do_accept(std::shared_ptr<State> state)
+{
+    tcp::acceptor& acceptor = state->acceptor;
+
+    acceptor.async_accept(asio::make_strand(state->io), [state](error_code ec, tcp::socket socket)
+        {
+            if (ec == asio::error::operation_aborted)
+            {
+                return;
+            }
+
+            if (!ec)
+            {
+                serve(state, std::move(socket));
+            }
+            else
+            {
+                write_error("Metrics accept error", ec);
+            }
+
+            if (state->acceptor.is_open())
+            {
+                do_accept(state);
+            }
+        });
+}
+
+void MetricsListener::close_connection(const std::shared_ptr<State>& state, const std::shared_ptr<Connection>& conn)
+{
+    conn->close();
+
+    std::lock_guard<std::mutex> lk(state->mtx);
+    state->connections.erase(conn);
+}
+
+void MetricsListener::serve(std::shared_ptr<State> state, tcp::socket socket)
+{
+    auto conn = std::make_shared<Connection>(std::move(socket));
+    {
+        std::lock_guard<std::mutex> lk(state->mtx);
+
+        if (state->stopped)
+        {
+            conn->close();
+            return;
+        }
+        state->connections.insert(conn);
+    }
+
+    conn->timer.expires_after(REQUEST_TIMEOUT);
+    conn->timer.async_wait([conn](error_code ec)
+        {
+            if (!ec)
+            {
+                // the pending read completes with an error and releases the connection
+                conn->close();
+            }
+        });
+
+    asio::async_read_until(conn->socket, conn->request, "\r\n\r\n",
+        [state, conn](error_code ec, std::size_t n)
+        {
+            if (ec)
+            {
+                close_connection(state, conn);
+                return;
+            }
+
+            conn->timer.cancel();
+
+            std::string line(asio::buffers_begin(conn->request.data()), asio::buffers_begin(conn->request.data()) + n);
+            line = line.substr(0, line.find("\r\n"));
+
+            bool found = line.compare(0, 13, "GET /metrics ") == 0 || line == "GET /metrics";
+
+            std::string body;
+            {
+                std::lock_guard<std::mutex> lk(state->mtx);
+
+                if (state->stopped)
+                {
+                    conn->close();
+                    return;
+                }
+
+                body = found ? state->render() : "not found\n";
+            }
+
+            conn->response = std::string(found ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n")
+                + "Content-Type: text/plain; version=0.0.4\r\n"
+                + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                + "Connection: close\r\n\r\n"
+                + body;
+
+            asio::async_write(conn->socket, asio::buffer(conn->response),
+                [state, conn](error_code /*ec*/, std::size_t /*n*/)
+                {
+                    close_connection(state, conn);
+                });
+        });
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+
+
+// Minimal HTTP/1.0 listener for metrics scraping: every GET /metrics is answered with
+// the text produced by the render callback (Prometheus text format), then the connection is closed.
+// Handlers hold the listener state, not the listener: after Stop() (or destruction) the render
+// callback is never called again, even while the io_context keeps running.
+class MetricsListener
+{
+public:
+    typedef std::function<std::string()> Render;
+
+    MetricsListener(boost::asio::io_context& io, uint16_t port, Render render);
+    ~MetricsListener();
+
+    // disable copying
+    MetricsListener(const MetricsListener&) = delete;
+    MetricsListener& operator=(const MetricsListener&) = delete;
+
+    void Start();
+    void Stop();        // closes the acceptor and every open connection
+
+    uint16_t GetPort() const;
+
+private:
+    struct State;
+    struct Connection;
+
+    static void do_accept(std::shared_ptr<State> state);
+    static void serve(std::shared_ptr<State> state, boost::asio::ip::tcp::socket socket);
+    static void close_connection(const std::shared_ptr<State>& state, const std::shared_ptr<Connection>& conn);
+
+private:
+    std::shared_ptr<State> m_state;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+// Bounded lock-free multi-producer / single-consumer ring buffer.
+// Every cell carries a sequence number telling whether it is free for the producer
+// at position pos (seq == pos) or filled for the consumer (seq == pos + 1).
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        m_cells.reset(new Cell[size]);
+        m_mask = size - 1;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // disable copying
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // any thread; false if the ring is full
+    bool TryPush(const T& value)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer thread only: move up to max items to out, returns the count
+    template <typename OutIt>
+    size_t TryPopBulk(OutIt out, size_t max)
+    {
+        size_t cnt = 0;
+
+        while (cnt < max)
+        {
+            Cell& cell = m_cells[m_head & m_mask];
+            if (cell.seq.load(std::memory_order_acquire) != m_head + 1)
+            {
+                break;
+            }
+
+            *out++ = std::move(cell.value);
+            cell.seq.store(m_head + m_mask + 1, std::memory_order_release);
+
+            m_head++;
+            cnt++;
+        }
+
+        return cnt;
+    }
+
+    // consumer thread only
+    bool Empty() const
+    {
+        return m_cells[m_head & m_mask].seq.load(std::memory_order_acquire) != m_head + 1;
+    }
+
+    size_t Capacity() const { return m_mask + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask{ 0 };
+
+    alignas(64) std::atomic<size_t> m_tail{ 0 };    // producers
+    alignas(64) size_t m_head{ 0 };                 // consumer
+};
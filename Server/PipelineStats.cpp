@@ -0,0 +1,111 @@
+// PipelineStats.cpp
+
+#include "PipelineStats.h"
+
+
+const char* stage_name(EStage stage)
+{
+    switch (stage)
+    {
+    case EStage::ingest_wait:   return "ingest_wait_ns";
+    case EStage::batch_size:    return "batch_size";
+    case EStage::encode:        return "encode_ns";
+    case EStage::fan_out:       return "fan_out_ns";
+    case EStage::session_wait:  return "session_wait_ns";
+    case EStage::socket_write:  return "socket_write_ns";
+    case EStage::write_bytes:   return "write_bytes";
+    default:                    return "unknown";
+    }
+}
+
+static std::atomic<uint64_t> g_next_id{ 1 };
+
+PipelineStats::PipelineStats()
+    : m_id(g_next_id.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+PipelineStats::Shard& PipelineStats::thread_shard()
+{
+    // the shards of the last instances this thread recorded into; on a miss the registry is
+    // searched by thread id under the lock, so a shard is found again after it left the cache
+    struct CachedShard
+    {
+        uint64_t id;
+        Shard* shard;
+    };
+    static const size_t CACHED = 4;
+    thread_local CachedShard cache[CACHED] = {};
+    thread_local size_t cache_next = 0;
+
+    for (const auto& c : cache)
+    {
+        if (c.id == m_id)
+        {
+            return *c.shard;
+        }
+    }
+
+    Shard* shard;
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_shards);
+
+        auto it = m_by_thread.find(std::this_thread::get_id());
+        if (it != m_by_thread.end())
+        {
+            shard = it->second;
+        }
+        else
+        {
+            // a thread id is reused only after its thread ended: the new thread takes over its shard
+            m_shards.push_back(std::make_unique<Shard>());
+            shard = m_shards.back().get();
+            m_by_thread.emplace(std::this_thread::get_id(), shard);
+        }
+    }
+
+    cache[cache_next++ % CACHED] = { m_id, shard };
+    return *shard;
+}
+
+void PipelineStats::Record(EStage stage, uint64_t value)
+{
+    thread_shard().stages[static_cast<size_t>(stage)].Record(value);
+}
+
+void PipelineStats::Collect(EStage stage, Histogram& out) const
+{
+    std::lock_guard<std::mutex> lk(m_mtx_shards);
+
+    for (const auto& shard : m_shards)
+    {
+        out.Merge(shard->stages[static_cast<size_t>(stage)]);
+    }
+}
+
+void PipelineStats::Reset()
+{
+    std::lock_guard<std::mutex> lk(m_mtx_shards);
+
+    for (const auto& shard : m_shards)
+    {
+        for (auto& h : shard->stages)
+        {
+            h.Reset();
+        }
+    }
+}
+
+size_t PipelineStats::GetShardCount() const
+{
+    std::lock_guard<std::mutex> lk(m_mtx_shards);
+    return m_shards.size();
+}
+
+uint64_t PipelineStats::DeltaNs(int64_t from, int64_t to)
+{
+    using namespace std::chrono;
+
+    auto ns = duration_cast<nanoseconds>(steady_clock::duration(to - from)).count();
+    return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Histogram.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+// measured points of the server pipeline
+enum class EStage : uint8_t
+{
+    ingest_wait,        // PushSignal -> dispatcher drain, ns (per update; conflate mode: per batch, oldest change)
+    batch_size,         // updates per dispatcher batch
+    encode,             // encoding of one payload, ns
+    fan_out,            // handing one batch to all sessions, ns
+    session_wait,       // DeliverPayload -> session strand, ns
+    socket_write,       // async_write start -> completion, ns
+    write_bytes,        // bytes per async_write
+
+    count
+};
+
+const char* stage_name(EStage stage);
+
+
+// Per-stage histograms, one shard per recording thread: a thread records into its own shard
+// without sharing cache lines, shards are merged only when the stats are read. A shard is
+// allocated on the thread's first Record (stats enabled) and registered with its collector,
+// where it stays after the thread ends; nothing is allocated while the stats stay off.
+class PipelineStats
+{
+public:
+    PipelineStats();
+
+    // disable copying
+    PipelineStats(const PipelineStats&) = delete;
+    PipelineStats& operator=(const PipelineStats&) = delete;
+
+    void Enable(bool is_enable) { m_enabled.store(is_enable, std::memory_order_relaxed); }
+    bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    void Record(EStage stage, uint64_t value);
+
+    // merge all shards of the stage into out
+    void Collect(EStage stage, Histogram& out) const;
+    void Reset();
+
+    size_t GetShardCount() const;
+
+    static int64_t Now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }      // steady ticks, for Record deltas
+    static uint64_t DeltaNs(int64_t from, int64_t to);
+    static uint64_t ElapsedNs(int64_t from) { return DeltaNs(from, Now()); }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::array<Histogram, static_cast<size_t>(EStage::count)> stages;
+    };
+
+    Shard& thread_shard();
+
+    const uint64_t m_id;        // never reused, tells the thread caches of different instances apart
+    mutable std::mutex m_mtx_shards;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::unordered_map<std::thread::id, Shard*> m_by_thread;
+    std::atomic<bool> m_enabled{ false };
+};
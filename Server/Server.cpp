@@ -4,7 +4,14 @@
 #include "Session.h"
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <unordered_set>
+#include <random>
+#include <cassert>
 #include <Utils.h>
+#include <Codec.h>
 
 
 namespace asio = boost::asio;
@@ -15,11 +22,45 @@ using steady_clock = std::chrono::steady_clock;
 
 
 
+#if defined(SO_REUSEPORT)
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+#endif
+
+
 Server::Server(asio::io_context& io, uint16_t port)
-    : m_io(io), m_acceptor(io, tcp::endpoint(tcp::v4(), port), true/*false*/)
+    : m_io(io), m_acceptor(io)
 {
     //Start();
 
+    open_acceptor(m_acceptor, port, false);
+
+    m_dispatcher = std::thread(&Server::dispatcher_loop, this);
+    m_producer = std::thread(&Server::producer_loop, this);
+}
+
+Server::Server(IoPool& pool, uint16_t port, EAcceptMode mode)
+    : m_io(pool.Get(0)), m_acceptor(pool.Get(0)), m_pool(&pool), m_accept_mode(mode)
+{
+#if !defined(SO_REUSEPORT)
+    m_accept_mode = EAcceptMode::round_robin;
+#endif
+
+    bool reuse_port = (m_accept_mode == EAcceptMode::reuse_port);
+
+    open_acceptor(m_acceptor, port, reuse_port);
+
+    if (reuse_port)
+    {
+        // one acceptor per context on the same port, the kernel spreads the connections
+        port = m_acceptor.local_endpoint().port();
+
+        for (size_t i = 1; i < pool.Size(); i++)
+        {
+            m_acceptors_reuse_port.emplace_back(std::make_unique<tcp::acceptor>(pool.Get(i)));
+            open_acceptor(*m_acceptors_reuse_port.back(), port, true);
+        }
+    }
+
     m_dispatcher = std::thread(&Server::dispatcher_loop, this);
     m_producer = std::thread(&Server::producer_loop, this);
 }
@@ -29,27 +70,81 @@ Server::~Server()
     Stop();
 }
 
+void Server::open_acceptor(tcp::acceptor& acceptor, uint16_t port, bool reuse_port)
+{
+    tcp::endpoint endpoint(tcp::v4(), port);
+
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+
+#if defined(SO_REUSEPORT)
+    if (reuse_port)
+    {
+        acceptor.set_option(reuse_port_option(true));
+    }
+#else
+    (void)reuse_port;
+#endif
+
+    acceptor.bind(endpoint);
+    acceptor.listen();
+}
+
+uint16_t Server::GetPort() const
+{
+    error_code ec;
+    return m_acceptor.local_endpoint(ec).port();
+}
+
 void Server::Start() 
 {
-    do_accept();
+    if (m_heartbeat_policy.alive_interval.count() || m_heartbeat_policy.drain_timeout.count())
+    {
+        m_wheel = std::make_unique<TimerWheel>(m_io, m_heartbeat_policy.tick, m_heartbeat_policy.wheel_slots);
+        m_wheel->Start();
+    }
+
+    if (m_metrics_enabled && !m_metrics)
+    {
+        m_metrics = std::make_unique<MetricsListener>(m_io, m_metrics_port, [this]() { return GetMetricsText(); });
+        m_metrics->Start();
+    }
+
+    do_accept(m_acceptor);
+
+    for (auto& acceptor : m_acceptors_reuse_port)
+    {
+        do_accept(*acceptor);
+    }
 
     if (m_show_log_msg)
         std::cout << "Server started\n";
 }
 
-void Server::do_accept() 
+void Server::do_accept(tcp::acceptor& acceptor) 
 {
-    m_acceptor.async_accept([this](error_code ec, tcp::socket socket) 
+    auto handler = [this, &acceptor](error_code ec, tcp::socket socket) 
         {
             if (!ec) 
             {
                 if (m_show_log_msg)
                     std::cout << "Accepted connection\n";
 
+                m_counters.sessions_accepted.Add();
+
                 auto s = std::make_shared<Session>(std::move(socket), *this);
                 s->Start();
 
-                do_accept();
+                if (m_wheel)
+                {
+                    m_wheel->Add([this, w = std::weak_ptr<Session>(s)](time_point now)
+                        {
+                            auto sp = w.lock();
+                            return sp && sp->CheckTimeouts(now, m_heartbeat_policy);
+                        });
+                }
+
+                do_accept(acceptor);
             }
             else if (ec == boost::asio::error::operation_aborted)
             {
@@ -63,7 +158,7 @@ void Server::do_accept()
                 // Recoverable errors (need to try again).
 
                 write_error("Accept error", ec);
-                do_accept();
+                do_accept(acceptor);
             }
             else
             {
@@ -74,16 +169,45 @@ void Server::do_accept()
                 // do_accept() should never be called !
 
             }
-        });
+        };
+
+    if (m_pool && m_accept_mode == EAcceptMode::round_robin)
+    {
+        // the session socket (and so its strand) lives on the next context of the pool
+        acceptor.async_accept(m_pool->Next(), std::move(handler));
+    }
+    else
+    {
+        acceptor.async_accept(std::move(handler));
+    }
 }
 
 void Server::Stop() 
 {
-    m_running = false;
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_queue);
+        m_running = false;
+    }
 
     // wake dispatcher
     m_cv_queue.notify_all();
 
+    // release ...AndWait callers, the dispatcher will not apply their change
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_schema);
+    }
+    m_cv_schema.notify_all();
+
+    if (m_wheel)
+    {
+        m_wheel->Stop();
+    }
+
+    if (m_metrics)
+    {
+        m_metrics->Stop();
+    }
+
     // close acceptor
     error_code ec;
 
@@ -97,6 +221,11 @@ void Server::Stop()
         m_acceptor.close(ec);
     }
 
+    for (auto& acceptor : m_acceptors_reuse_port)
+    {
+        acceptor->close(ec);
+    }
+
     if (m_producer.joinable())
     {
         m_producer.join();
@@ -113,223 +242,1285 @@ void Server::Stop()
 
 void Server::SetSignals(const VecSignal signals)
 {
-    asio::post(m_io, [this, signals]()
-        {
-            // Closing all client connections so that clients can reconnect and receive the changed count of signals.
-
-            std::lock_guard<std::mutex> lk(m_mtx_subscribers);
-
-            for (auto it = m_subscribers.begin(); it != m_subscribers.end();)
-            {
-                if (auto sp = it->lock())
-                {
-                    sp->ForceClose();
-                    ++it;
-                }
-                else
-                {
-                    it = m_subscribers.erase(it);
-                }
-            }
+    queue_schema_op({ SchemaOp::set, signals, {} });
+}
 
-            // set signals
+void Server::AddSignals(const VecSignal& signals)
+{
+    queue_schema_op({ SchemaOp::add, signals, {} });
+}
 
-            {
-                std::lock_guard<std::mutex> lk(m_mtx_state);
+void Server::RemoveSignals(const std::vector<uint32_t>& ids)
+{
+    queue_schema_op({ SchemaOp::remove, {}, ids });
+}
 
-                m_state.clear();
+void Server::SetSignalsAndWait(const VecSignal& signals)
+{
+    wait_schema_applied(queue_schema_op({ SchemaOp::set, signals, {} }));
+}
 
-                auto now = steady_clock::now();
+void Server::AddSignalsAndWait(const VecSignal& signals)
+{
+    wait_schema_applied(queue_schema_op({ SchemaOp::add, signals, {} }));
+}
 
-                for (auto s : signals)
-                {
-                    m_state[s.id] = s;
-                }
-            }
-        });
+void Server::RemoveSignalsAndWait(const std::vector<uint32_t>& ids)
+{
+    wait_schema_applied(queue_schema_op({ SchemaOp::remove, {}, ids }));
 }
 
-void Server::RegisterSession(std::shared_ptr<Session> s) 
+uint64_t Server::queue_schema_op(SchemaOp op)
 {
-    std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_schema);
+        m_schema_ops.push_back(std::move(op));
+        ticket = ++m_schema_queued;
+    }
 
-    m_subscribers.push_back(s);
+    m_schema_changed.store(true, std::memory_order_relaxed);
+    wake_dispatcher();
+
+    return ticket;
 }
 
-void Server::UnregisterExpired() 
+void Server::wait_schema_applied(uint64_t ticket)
 {
-    std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+    // the dispatcher applies the change: waiting for it there would never return
+    assert(std::this_thread::get_id() != m_dispatcher.get_id());
 
-    m_subscribers.erase(std::remove_if(m_subscribers.begin(), m_subscribers.end(),
-        [](const std::weak_ptr<Session>& w) 
-        { 
-            return w.expired(); 
-        }),
-        m_subscribers.end());
+    std::unique_lock<std::mutex> lk(m_mtx_schema);
+    m_cv_schema.wait(lk, [&] { return m_schema_applied >= ticket || !m_running; });
 }
 
-bool Server::PushSignal(const Signal& s) 
+void Server::apply_schema_ops()
 {
-    bool pushed = false;
-
+    std::vector<SchemaOp> ops;
+    uint64_t ticket;
     {
-        std::lock_guard<std::mutex> lk_state(m_mtx_state);
-
-        auto it = m_state.find(s.id);
+        std::lock_guard<std::mutex> lk(m_mtx_schema);
 
-        if (it != m_state.end() && s.ts >= it->second.ts)
-        {
-            m_state[s.id] = s;
-            pushed = true;
-        }
+        m_schema_changed.store(false, std::memory_order_relaxed);
+        ops.swap(m_schema_ops);
+        ticket = m_schema_queued;
     }
 
-    if (pushed)
+    if (!ops.empty())
     {
-        {
-            std::lock_guard<std::mutex> lk_queue(m_mtx_queue);
-            m_queue.push_back(s);
-        }
-        m_cv_queue.notify_one();
+        apply_schema(ops);
     }
 
-    return pushed;
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_schema);
+        m_schema_applied = ticket;
+    }
+    m_cv_schema.notify_all();
 }
 
-bool Server::GetSignal(int id, Signal& s)
+void Server::apply_schema(const std::vector<SchemaOp>& ops)
 {
-    std::lock_guard<std::mutex> lk(m_mtx_state);
+    const uint8_t ALL_TYPES = static_cast<uint8_t>(ESignalType::discret | ESignalType::analog);
 
-    auto it = m_state.find(id);
-    if (it != m_state.end())
+    // target set: the current one (with its live values) changed by the ops in order;
+    // signals passed by the caller take the caller's value (the last one of an id wins)
+    const VecSignal current = m_state.Snapshot(ALL_TYPES);
+
+    VecSignal target = current;
+    std::unordered_map<uint32_t, size_t> pos;      // id -> position in target
+    for (size_t i = 0; i < target.size(); i++)
     {
-        s = it->second;
-        return true;
+        pos.emplace(target[i].id, i);
     }
 
-    return false;
-}
+    std::unordered_set<uint32_t> given;             // ids whose value comes from the ops
 
-VecSignal Server::GetSnapshot(uint8_t type) 
-{
-    VecSignal out;
-    std::lock_guard<std::mutex> lk(m_mtx_state);
+    auto upsert = [&](const Signal& s)
+        {
+            auto it = pos.emplace(s.id, target.size());
+            if (it.second)
+            {
+                target.push_back(s);
+            }
+            else
+            {
+                target[it.first->second] = s;
+            }
+            given.insert(s.id);
+        };
 
-    for (auto& p : m_state)
+    for (const auto& op : ops)
     {
-        if ((uint8_t)p.second.type & type)
+        if (op.kind == SchemaOp::set)
         {
-            out.push_back(p.second);
+            target.clear();
+            pos.clear();
+            given.clear();
+
+            for (const auto& s : op.signals)
+            {
+                upsert(s);
+            }
         }
-    }
+        else if (op.kind == SchemaOp::add)
+        {
+            for (const auto& s : op.signals)
+            {
+                upsert(s);
+            }
+        }
+        else
+        {
+            std::unordered_set<uint32_t> removed(op.ids.begin(), op.ids.end());
 
-    return out;
-}
+            target.erase(std::remove_if(target.begin(), target.end(), [&](const Signal& s) { return removed.count(s.id) != 0; }), target.end());
 
-void Server::dispatcher_loop() 
-{
-    while (m_running) 
-    {
-        VecSignal batch;
+            pos.clear();
+            for (size_t i = 0; i < target.size(); i++)
+            {
+                pos.emplace(target[i].id, i);
+            }
+
+            for (uint32_t id : op.ids)
+            {
+                given.erase(id);
+            }
+        }
+    }
 
+    // the other signals keep their live value, including updates pushed while we were at it
+    std::vector<uint32_t> carry_ids;
+    for (const auto& s : target)
+    {
+        if (!given.count(s.id))
         {
-            std::unique_lock<std::mutex> lk(m_mtx_queue);
+            carry_ids.push_back(s.id);
+        }
+    }
 
-            m_cv_queue.wait(lk, [&] 
-                {
-                    return !m_queue.empty() || !m_running; 
-                });
+    reset_replay();
+    m_state.Reset(target, carry_ids);
+    m_state_epoch.fetch_add(1, std::memory_order_release);
+
+    // diff: (old, new) per changed id, null = not in that set
+    std::vector<std::pair<const Signal*, const Signal*>> changes;
+    std::unordered_map<uint32_t, const Signal*> old_by_id;
+    for (const auto& s : current)
+    {
+        old_by_id.emplace(s.id, &s);
+    }
 
-            while (!m_queue.empty()) 
+    for (const auto& s : target)
+    {
+        auto it = old_by_id.find(s.id);
+        if (it == old_by_id.end())
+        {
+            changes.push_back({ nullptr, &s });
+        }
+        else
+        {
+            if (it->second->type != s.type || (given.count(s.id) && it->second->value != s.value))
             {
-                batch.push_back(m_queue.front()); 
-                m_queue.pop_front(); 
+                changes.push_back({ it->second, &s });
             }
+            old_by_id.erase(it);
         }
+    }
 
-        if (!batch.empty()) 
+    for (const auto& s : current)
+    {
+        if (old_by_id.count(s.id))
         {
-            // delivery: broadcast to subscribers
-            std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+            changes.push_back({ &s, nullptr });
+        }
+    }
+
+    if (changes.empty())
+    {
+        return;
+    }
+
+    if (m_registry_changed.load(std::memory_order_relaxed))
+    {
+        rebuild_subscribers();
+    }
 
-            for (auto it = m_subscribers.begin(); it != m_subscribers.end();) 
+    // per session: the changes as seen through its mask and id ranges
+    // (a retyped signal leaving or entering the mask is removed / added)
+    auto session_changes = [&](uint8_t mask, const VecIdRange* ids)
+        {
+            VecSchemaChange out;
+            for (const auto& c : changes)
             {
-                if (auto sp = it->lock()) 
+                const uint32_t id = c.first ? c.first->id : c.second->id;
+                if (ids && !id_in_ranges(*ids, id))
+                {
+                    continue;
+                }
+
+                bool was = c.first && ((uint8_t)c.first->type & mask);
+                bool is = c.second && ((uint8_t)c.second->type & mask);
+
+                if (!was && is)
+                {
+                    out.push_back({ SCHEMA_ADDED, *c.second });
+                }
+                else if (was && !is)
                 {
-                    sp->DeliverUpdates(batch);
-                    ++it;
+                    Signal s(c.first->id, c.first->type);
+                    out.push_back({ SCHEMA_REMOVED, s });
                 }
-                else
+                else if (was && is)
                 {
-                    it = m_subscribers.erase(it);
+                    out.push_back({ SCHEMA_RETYPED, *c.second });
                 }
             }
+            return out;
+        };
+
+    auto subscribers = std::atomic_load(&m_subscribers);
+
+    SharedPayload by_mask[ALL_TYPES + 1];     // whole-mask subscribers share the payload
+
+    for (const auto& sub : subscribers->all)
+    {
+        SharedPayload payload;
+
+        if (sub.ids)
+        {
+            payload = make_schema_payload(session_changes(sub.mask, sub.ids.get()));
+        }
+        else
+        {
+            SharedPayload& shared = by_mask[sub.mask & ALL_TYPES];
+            if (!shared)
+            {
+                shared = make_schema_payload(session_changes(sub.mask, nullptr));
+            }
+            payload = shared;
+        }
+
+        if (!payload->empty())
+        {
+            sub.session->DeliverSchema(payload);
         }
     }
+
+    if (m_show_log_msg)
+        std::cout << "Signal set changed: " << changes.size() << " signal(s), " << target.size() << " in total\n";
 }
 
-void Server::producer_loop()
+void Server::RegisterSession(std::shared_ptr<Session> s, std::shared_ptr<const VecIdRange> id_filter, WireFormat format) 
 {
-    // Currently, this is data emulation. 
-    // It will be replaced with real data ingestion later.
+    uint8_t mask = s->GetReqType();
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+        m_registry_ops.push_back({ { std::move(s), mask, std::move(id_filter), format }, true });
+    }
 
-    std::mt19937 rng((unsigned)std::chrono::system_clock::now().time_since_epoch().count());
+    // applied by the dispatcher before it delivers the next batch; wake a parked one so the
+    // registry does not wait for data
+    m_registry_changed.store(true, std::memory_order_relaxed);
+    wake_dispatcher();
+}
 
-    std::uniform_int_distribution<int> discret_val(0, 1);
-    std::uniform_real_distribution<double> delta(-0.5, 0.5);
+void Server::UnregisterSession(std::shared_ptr<Session> s)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+        m_registry_ops.push_back({ { std::move(s), 0, nullptr, WireFormat() }, false });
+    }
 
-    while (m_running)
+    // the registry holds strong handles: let a parked dispatcher release them now
+    m_registry_changed.store(true, std::memory_order_relaxed);
+    wake_dispatcher();
+}
+
+size_t Server::GetSubscriberCount() const
+{
+    return std::atomic_load(&m_subscribers)->all.size();
+}
+
+void Server::rebuild_subscribers()
+{
+    std::vector<RegistryOp> ops;
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(700 + (rng() % 800)));
+        std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+
+        m_registry_changed.store(false, std::memory_order_relaxed);
+        ops.swap(m_registry_ops);
+    }
+
+    if (ops.empty())
+    {
+        return;
+    }
+
+    // the last pending operation of a session wins
+    std::unordered_map<Session*, const RegistryOp*> last_op;
+    for (const auto& op : ops)
+    {
+        last_op[op.subscriber.session.get()] = &op;
+    }
 
-        if (!m_data_emulation || m_state.empty())
+    auto old = std::atomic_load(&m_subscribers);
+    auto subscribers = std::make_shared<Subscribers>();
+    subscribers->all.reserve(old->all.size() + ops.size());
+
+    // a session subscribes once, so the only operation on one already registered is its removal
+    for (const auto& sub : old->all)
+    {
+        if (last_op.find(sub.session.get()) == last_op.end())
         {
-            continue;
+            subscribers->all.push_back(sub);
+        }
+    }
+
+    for (const auto& op : ops)
+    {
+        auto it = last_op.find(op.subscriber.session.get());
+        if (it != last_op.end() && it->second->add)
+        {
+            subscribers->all.push_back(it->second->subscriber);
+            last_op.erase(it);
         }
+    }
 
-        int state_size;
+    // whole-mask subscribers: grouped by mask and wire format, each group receives one shared payload
+    std::vector<const Subscriber*> whole;
+    for (const auto& sub : subscribers->all)
+    {
+        if (sub.ids)
         {
-            std::lock_guard<std::mutex> lk(m_mtx_state);
-            state_size = m_state.size();
+            subscribers->filtered.push_back(sub);
         }
+        else
+        {
+            whole.push_back(&sub);
+        }
+    }
 
-        std::uniform_int_distribution<int> ids(1, state_size);
+    std::stable_sort(whole.begin(), whole.end(),
+        [](const Subscriber* a, const Subscriber* b) { return a->mask != b->mask ? a->mask < b->mask : a->format < b->format; });
 
-        std::uniform_int_distribution<int> cnt_rnd(1, state_size);
-        int cnt = cnt_rnd(rng);
+    for (size_t i = 0; i < whole.size(); i++)
+    {
+        subscribers->sessions.push_back(whole[i]->session);
 
-        for (int i = 0; i < cnt; i++)
+        if (subscribers->groups.empty() || subscribers->groups.back().mask != whole[i]->mask || subscribers->groups.back().format != whole[i]->format)
         {
-            int id = ids(rng);
+            subscribers->groups.push_back({ whole[i]->mask, whole[i]->format, i, i });
+        }
+        subscribers->groups.back().end = i + 1;
+    }
 
-            Signal current_s;
-            if (!GetSignal(id, current_s))
-            {
-                continue;
-            }
+    // id-filtered subscribers: inverted index (ranges are normalized, so an id maps to a subscriber once);
+    // the index entries of a subscriber are bounded, so many narrow ranges cannot blow up the rebuild
+    for (uint32_t i = 0; i < subscribers->filtered.size(); i++)
+    {
+        size_t expanded = 0;
 
-            // generate new signal
-            Signal new_s = current_s;
-            new_s.value = (new_s.type == ESignalType::discret) ? (discret_val(rng)) : new_s.value + delta(rng);
-            new_s.ts = steady_clock::now();
+        for (const auto& r : *subscribers->filtered[i].ids)
+        {
+            const size_t width = (size_t)(r.last - r.first) + 1;
 
-            PushSignal(new_s);
+            if (width <= MAX_EXPANDED_RANGE && expanded + width <= MAX_EXPANDED_IDS)
+            {
+                for (uint64_t id = r.first; id <= r.last; id++)
+                {
+                    subscribers->by_id[(uint32_t)id].push_back(i);
+                }
+                expanded += width;
+            }
+            else
+            {
+                subscribers->wide.push_back({ r.first, r.last, i });
+            }
         }
     }
-}
 
+    std::atomic_store(&m_subscribers, std::shared_ptr<const Subscribers>(std::move(subscribers)));
+}
 
-void Server::clear_sessions()
+void Server::SetFanOutThreads(size_t threads)
 {
-    std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+    std::unique_ptr<IoPool> pool;
+    if (threads > 1)
+    {
+        // the dispatcher thread takes one shard itself
+        pool = std::make_unique<IoPool>(threads - 1);
+        pool->Run();
+    }
 
-    for (auto& it : m_subscribers)
+    // the dispatcher may be in the middle of a fan-out on the current pool: it swaps them between batches
+    std::unique_ptr<IoPool> replaced;
     {
-        if (auto sp = it.lock())
-        {
-            sp->ForceClose();
-        }
+        std::lock_guard<std::mutex> lk(m_mtx_fanout);
+        replaced = std::move(m_fanout_pending);     // never taken, no work on it
+        m_fanout_pending = std::move(pool);
+        m_fanout_changed.store(true, std::memory_order_release);
+    }
+}
+
+void Server::swap_fanout_pool()
+{
+    std::unique_ptr<IoPool> pool;
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_fanout);
+
+        m_fanout_changed.store(false, std::memory_order_relaxed);
+        pool = std::move(m_fanout_pending);
     }
 
-    m_subscribers.clear();
-}
\ No newline at end of file
+    // the previous batch has joined all its shards: the old pool is idle
+    m_fanout_pool.swap(pool);
+}
+
+bool Server::PushSignal(const Signal& s) 
+{
+    if (!m_state.Update(s))
+    {
+        m_counters.updates_dropped.Add();
+        return false;
+    }
+
+    m_counters.updates_ingested.Add();
+
+    if (enqueue(s))
+    {
+        wake_dispatcher();
+    }
+
+    return true;
+}
+
+std::vector<bool> Server::PushSignals(const Signal* signals, size_t count)
+{
+    std::vector<bool> accepted(count, false);
+    size_t cnt_accepted = 0;
+    bool need_wake = false;
+
+    if (m_ingest_mode == EIngestMode::conflate)
+    {
+        // the whole block under one acquisition
+        std::lock_guard<std::mutex> lk_queue(m_mtx_queue);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (m_state.Update(signals[i]))
+            {
+                accepted[i] = true;
+                cnt_accepted++;
+                need_wake |= enqueue_conflated(signals[i]);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (m_state.Update(signals[i]))
+            {
+                accepted[i] = true;
+                cnt_accepted++;
+                need_wake |= enqueue_queued(signals[i]);
+            }
+        }
+    }
+
+    m_counters.updates_ingested.Add(cnt_accepted);
+    m_counters.updates_dropped.Add(count - cnt_accepted);
+
+    // one wakeup for the whole block
+    if (need_wake)
+    {
+        wake_dispatcher();
+    }
+
+    return accepted;
+}
+
+std::vector<bool> Server::PushSignals(const VecSignal& signals)
+{
+    return PushSignals(signals.data(), signals.size());
+}
+
+bool Server::enqueue(const Signal& s)
+{
+    if (m_ingest_mode == EIngestMode::conflate)
+    {
+        std::lock_guard<std::mutex> lk_queue(m_mtx_queue);
+
+        return enqueue_conflated(s);
+    }
+
+    return enqueue_queued(s);
+}
+
+bool Server::enqueue_conflated(const Signal& s)
+{
+    auto it = m_dirty_pos.find(s.id);
+    if (it != m_dirty_pos.end())
+    {
+        // already pending: keep only the newest value, the dispatcher was woken for it already
+        // (writers racing on one signal may get here out of timestamp order)
+        Signal& pending = m_dirty[it->second];
+        if (s.ts >= pending.ts)
+        {
+            pending = s;
+        }
+        m_counters.updates_conflated.Add();
+        return false;
+    }
+
+    if (m_dirty.empty() && m_stats.IsEnabled())
+    {
+        m_dirty_since = PipelineStats::Now();
+    }
+
+    m_dirty_pos.emplace(s.id, m_dirty.size());
+    m_dirty.push_back(s);
+    return true;
+}
+
+bool Server::enqueue_queued(const Signal& s)
+{
+    // the ring is bounded: wait for the dispatcher when producers outrun it
+    const QueuedSignal q{ s, m_stats.IsEnabled() ? PipelineStats::Now() : 0 };
+
+    while (!m_queue.TryPush(q))
+    {
+        if (!m_running)
+        {
+            return false;
+        }
+
+        // a bulk producer wakes the dispatcher only at the end of the block
+        wake_dispatcher();
+        std::this_thread::yield();
+    }
+
+    return true;
+}
+
+void Server::wake_dispatcher()
+{
+    // wakeup elision: the condition variable is signalled only while the dispatcher is parked
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_dispatcher_parked.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_queue);
+        m_cv_queue.notify_one();
+    }
+}
+
+uint16_t Server::GetMetricsPort() const
+{
+    return m_metrics ? m_metrics->GetPort() : 0;
+}
+
+std::string Server::GetMetricsText() const
+{
+    std::ostringstream out;
+
+    auto counter = [&out](const char* name, const char* help, const ShardedCounter& c)
+        {
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " counter\n"
+                << name << " " << c.Value() << "\n";
+        };
+
+    auto gauge = [&out](const char* name, const char* help)
+        {
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " gauge\n";
+        };
+
+    counter("signal_server_updates_ingested_total", "Updates accepted by PushSignal(s).", m_counters.updates_ingested);
+    counter("signal_server_updates_dropped_total", "Updates rejected (unknown id or stale).", m_counters.updates_dropped);
+    counter("signal_server_updates_conflated_total", "Updates replaced by a newer value before dispatch.", m_counters.updates_conflated);
+    counter("signal_server_batches_total", "Dispatcher batches.", m_counters.batches);
+    counter("signal_server_batch_updates_total", "Updates in dispatcher batches.", m_counters.batch_updates);
+    counter("signal_server_frames_sent_total", "Frames written to sockets.", m_counters.frames_sent);
+    counter("signal_server_bytes_sent_total", "Bytes written to sockets.", m_counters.bytes_sent);
+    counter("signal_server_sessions_accepted_total", "Accepted connections.", m_counters.sessions_accepted);
+    counter("signal_server_sessions_closed_total", "Closed sessions.", m_counters.sessions_closed);
+    counter("signal_server_slow_consumer_events_total", "Sessions switched to conflation.", m_counters.slow_consumer_events);
+    counter("signal_server_snapshots_built_total", "Initial state frames encoded.", m_counters.snapshots_built);
+    counter("signal_server_snapshots_shared_total", "Subscribers served from a cached initial state frame.", m_counters.snapshots_shared);
+    counter("signal_server_resumes_total", "Resuming subscribers served from the replay ring.", m_counters.resumes);
+    counter("signal_server_resume_misses_total", "Resuming subscribers sent the initial state instead.", m_counters.resume_misses);
+    counter("signal_server_reconciles_total", "Subscribers synchronized by bucket digests.", m_counters.reconciles);
+    counter("signal_server_reconcile_buckets_resent_total", "Digest buckets resent to reconciling subscribers.", m_counters.reconcile_buckets_resent);
+
+    // sessions as seen by the dispatcher
+    auto subscribers = std::atomic_load(&m_subscribers);
+    const auto now = steady_clock::now();
+
+    gauge("signal_server_subscribers", "Subscribed sessions.");
+    out << "signal_server_subscribers " << subscribers->all.size() << "\n";
+
+    size_t max_bytes = 0;
+    size_t max_frames = 0;
+    double max_lag = 0;
+
+    // per-session samples, one stream per family: each family's samples follow its own TYPE line
+    std::ostringstream per_session_bytes;
+    std::ostringstream per_session_frames;
+    std::ostringstream per_session_lag;
+    size_t cnt = 0;
+
+    for (const auto& sub : subscribers->all)
+    {
+        const Session& s = *sub.session;
+        size_t bytes = s.GetQueuedBytes();
+        size_t frames = s.GetQueuedFrames();
+        double lag = std::chrono::duration<double>(s.GetLag(now)).count();
+
+        max_bytes = std::max(max_bytes, bytes);
+        max_frames = std::max(max_frames, frames);
+        max_lag = std::max(max_lag, lag);
+
+        if (cnt++ < MAX_SESSION_METRICS)
+        {
+            per_session_bytes << "signal_server_session_queue_bytes{session=\"" << s.GetId() << "\"} " << bytes << "\n";
+            per_session_frames << "signal_server_session_queue_frames{session=\"" << s.GetId() << "\"} " << frames << "\n";
+            per_session_lag << "signal_server_session_lag_seconds{session=\"" << s.GetId() << "\"} " << lag << "\n";
+        }
+    }
+
+    gauge("signal_server_session_queue_bytes_max", "Largest session write queue, bytes.");
+    out << "signal_server_session_queue_bytes_max " << max_bytes << "\n";
+    gauge("signal_server_session_queue_frames_max", "Largest session write queue, frames.");
+    out << "signal_server_session_queue_frames_max " << max_frames << "\n";
+    gauge("signal_server_session_lag_seconds_max", "Oldest undrained session write.");
+    out << "signal_server_session_lag_seconds_max " << max_lag << "\n";
+
+    // per-session series, the first MAX_SESSION_METRICS subscribers
+    gauge("signal_server_session_queue_bytes", "Session write queue, bytes.");
+    out << per_session_bytes.str();
+    gauge("signal_server_session_queue_frames", "Session write queue, frames.");
+    out << per_session_frames.str();
+    gauge("signal_server_session_lag_seconds", "Age of the session write in flight.");
+    out << per_session_lag.str();
+
+    // batch size distribution, only with stats enabled
+    if (m_stats.IsEnabled())
+    {
+        Histogram h;
+        m_stats.Collect(EStage::batch_size, h);
+
+        out << "# HELP signal_server_batch_size Dispatcher batch size quantiles (since the last stats reset).\n"
+            << "# TYPE signal_server_batch_size summary\n";
+        for (double q : { 0.5, 0.9, 0.99 })
+        {
+            out << "signal_server_batch_size{quantile=\"" << q << "\"} " << h.Percentile(q * 100) << "\n";
+        }
+        out << "signal_server_batch_size{quantile=\"1\"} " << h.Max() << "\n"
+            << "signal_server_batch_size_count " << h.Count() << "\n";
+    }
+
+    return out.str();
+}
+
+bool Server::GetSignal(int id, Signal& s)
+{
+    return m_state.Get(id, s);
+}
+
+VecSignal Server::GetSnapshot(uint8_t type) 
+{
+    return m_state.Snapshot(type);
+}
+
+Server::SnapshotFrames Server::GetSnapshotFrames(uint8_t mask, const WireFormat& format)
+{
+    // concurrent subscribers of the same key wait for one build instead of scanning the store each;
+    // the lock only covers the lookup, the build runs outside it and other keys do not wait for it
+    std::promise<SnapshotFrames> build;
+    std::shared_future<SnapshotFrames> frames;
+    uint64_t seq = 0;
+    bool builder = false;
+
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_snapshots);
+
+        // the epoch is read before the store: a signal set change after it bumps it
+        const uint64_t epoch = m_state_epoch.load(std::memory_order_acquire);
+
+        // likewise the sequence number: the store holds at least every update up to it
+        const uint64_t current = GetSequence();
+
+        // a cached state some updates old is still good, the subscriber catches up from the replay ring;
+        // a new one is built once the updates since outnumber the signals (or the ring)
+        CachedSnapshot& cached = m_snapshots[{ mask, format }];
+        if (cached.frames.valid() && cached.epoch == epoch &&
+            current - cached.seq <= std::min(cached.signals, m_replay_capacity.load(std::memory_order_relaxed)))
+        {
+            frames = cached.frames;
+            seq = cached.seq;
+        }
+        else
+        {
+            seq = current;
+
+            frames = build.get_future().share();
+            cached = { epoch, seq, m_state.Size(), frames };
+            builder = true;
+        }
+    }
+
+    if (!builder)
+    {
+        SnapshotFrames shared = frames.get();
+
+        // the updates after the cached state, unless the ring has dropped them meanwhile
+        SnapshotFrames missed = replay_frames(seq, mask, nullptr, format);
+        if (missed)
+        {
+            m_counters.snapshots_shared.Add();
+
+            if (missed->empty())
+            {
+                return shared;
+            }
+
+            auto joined = std::make_shared<std::vector<SharedPayload>>(*shared);
+            joined->insert(joined->end(), missed->begin(), missed->end());
+            return joined;
+        }
+
+        seq = GetSequence();
+    }
+
+    SnapshotFrames built = EncodeSnapshot(m_state.Snapshot(mask), mask, format, seq);
+    if (builder)
+    {
+        build.set_value(built);
+    }
+    m_counters.snapshots_built.Add();
+
+    return built;
+}
+
+Server::SnapshotFrames Server::EncodeSnapshot(const VecSignal& signals, uint8_t mask, const WireFormat& format, uint64_t seq) const
+{
+    // bounded frames: no frame near the receive size cap, and a session starts writing after the first chunk
+    auto frames = std::make_shared<std::vector<SharedPayload>>();
+    frames->reserve((signals.size() + m_snapshot_chunk - 1) / m_snapshot_chunk);
+
+    size_t begin = 0;
+    do
+    {
+        SharedPayload payload = EncodeSnapshotFrame(signals, begin, mask, format, seq);
+        if (!payload->empty())
+        {
+            frames->push_back(std::move(payload));
+        }
+    } while (begin < signals.size());
+
+    return frames;
+}
+
+SharedPayload Server::EncodeSnapshotFrame(const VecSignal& signals, size_t& begin, uint8_t mask, const WireFormat& format, uint64_t seq) const
+{
+    // sequenced: the first frame resets the receiver, only the last one moves its position to seq,
+    // so a client cut off in the middle of the snapshot does not resume from it
+    size_t end = std::min(begin + m_snapshot_chunk, signals.size());
+    VecSignal chunk(signals.begin() + begin, signals.begin() + end);
+
+    FrameSeq pos;
+    pos.seq = end == signals.size() ? seq : 0;
+    pos.reset = begin == 0;
+
+    begin = end;
+
+    return make_shared_payload(chunk, mask, format, pos);
+}
+
+Server::SnapshotFrames Server::GetReplayFrames(uint64_t seq, uint8_t mask, const VecIdRange* ids, const WireFormat& format)
+{
+    SnapshotFrames frames = replay_frames(seq, mask, ids, format);
+    if (frames)
+    {
+        m_counters.resumes.Add();
+    }
+    else
+    {
+        m_counters.resume_misses.Add();
+    }
+
+    return frames;
+}
+
+Server::SnapshotFrames Server::replay_frames(uint64_t seq, uint8_t mask, const VecIdRange* ids, const WireFormat& format)
+{
+    // the missed updates of this subscription with their sequence numbers
+    VecSignal missed;
+    std::vector<uint64_t> missed_seq;
+    uint64_t last;
+
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_replay);
+
+        last = m_replay.empty() ? m_replay_from : m_replay.back().first_seq + m_replay.back().batch->size() - 1;
+
+        if (seq < m_replay_from || seq > last)
+        {
+            return nullptr;
+        }
+
+        // first batch with updates after seq
+        auto it = std::partition_point(m_replay.begin(), m_replay.end(),
+            [seq](const ReplayEntry& e) { return e.first_seq + e.batch->size() - 1 <= seq; });
+
+        for (; it != m_replay.end(); ++it)
+        {
+            const VecSignal& batch = *it->batch;
+
+            for (size_t i = seq >= it->first_seq ? seq - it->first_seq + 1 : 0; i < batch.size(); i++)
+            {
+                const Signal& s = batch[i];
+                if (((uint8_t)s.type & mask) && (!ids || id_in_ranges(*ids, s.id)))
+                {
+                    missed.push_back(s);
+                    missed_seq.push_back(it->first_seq + i);
+                }
+            }
+        }
+    }
+
+    // every update kept, in order; each frame moves the client to its last update, the final one to
+    // the end of the ring (nothing later matched the subscription)
+    auto frames = std::make_shared<std::vector<SharedPayload>>();
+
+    VecSignal chunk;
+    for (size_t begin = 0; begin < missed.size(); begin += m_snapshot_chunk)
+    {
+        size_t end = std::min(begin + m_snapshot_chunk, missed.size());
+        chunk.assign(missed.begin() + begin, missed.begin() + end);
+
+        FrameSeq pos;
+        pos.seq = end == missed.size() ? last : missed_seq[end - 1];
+
+        frames->push_back(make_shared_payload(chunk, mask, format, pos));
+    }
+
+    return frames;
+}
+
+Server::SnapshotFrames Server::GetReconcileFrames(const std::vector<uint64_t>& digests, uint8_t mask, const VecIdRange* ids, const WireFormat& format, SharedPayload& reconcile)
+{
+    const uint32_t buckets = static_cast<uint32_t>(digests.size());
+
+    // as for a snapshot: the sequence number before the store
+    const uint64_t seq = GetSequence();
+
+    VecSignal signals = m_state.Snapshot(mask);
+    if (ids)
+    {
+        signals.erase(std::remove_if(signals.begin(), signals.end(), [&](const Signal& s) { return !id_in_ranges(*ids, s.id); }), signals.end());
+    }
+
+    const std::vector<uint64_t> own = compute_digests(signals, buckets, format.options);
+
+    std::vector<uint32_t> resent;
+    for (uint32_t b = 0; b < buckets; b++)
+    {
+        if (own[b] != digests[b])
+        {
+            resent.push_back(b);
+        }
+    }
+
+    // only the signals of the differing buckets are sent, the client drops what it holds in them first
+    signals.erase(std::remove_if(signals.begin(), signals.end(),
+        [&](const Signal& s) { const uint32_t b = digest_bucket(s.id, buckets); return own[b] == digests[b]; }), signals.end());
+
+    reconcile = make_reconcile_payload(buckets, resent);
+
+    m_counters.reconciles.Add();
+    m_counters.reconcile_buckets_resent.Add(resent.size());
+
+    // the last frame moves the client to seq, a frame without records if no signal is resent
+    auto frames = std::make_shared<std::vector<SharedPayload>>();
+
+    VecSignal chunk;
+    for (size_t begin = 0; begin < signals.size(); begin += m_snapshot_chunk)
+    {
+        size_t end = std::min(begin + m_snapshot_chunk, signals.size());
+        chunk.assign(signals.begin() + begin, signals.begin() + end);
+
+        FrameSeq pos;
+        pos.seq = end == signals.size() ? seq : 0;
+
+        frames->push_back(make_shared_payload(chunk, mask, format, pos));
+    }
+
+    if (frames->empty())
+    {
+        frames->push_back(make_position_payload(seq));
+    }
+
+    return frames;
+}
+
+uint64_t Server::initial_sequence()
+{
+    // a random base per instance in the upper half: a server restarted within the same second does not
+    // reuse the numbers its clients resume from either; never 0 (no resume), 2^63 updates of headroom
+    std::random_device rd;
+    uint64_t seed = (uint64_t(rd()) << 32) | rd();
+    seed ^= static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+    seed ^= static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+
+    return ((mix_u64(seed) >> 33) + 1) << 32;
+}
+
+void Server::record_replay(uint64_t first_seq, const SharedBatch& batch)
+{
+    const size_t capacity = m_replay_capacity.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lk(m_mtx_replay);
+
+    m_replay.push_back({ first_seq, batch });
+    m_replay_updates += batch->size();
+
+    while (!m_replay.empty() && m_replay_updates > capacity)
+    {
+        const ReplayEntry& e = m_replay.front();
+        m_replay_from = e.first_seq + e.batch->size() - 1;
+        m_replay_updates -= e.batch->size();
+        m_replay.pop_front();
+    }
+}
+
+void Server::reset_replay()
+{
+    // the batches describe the old signal set: nobody resumes across the change
+    // (it takes a sequence number of its own, so a client at the last update cannot resume either)
+    std::lock_guard<std::mutex> lk(m_mtx_replay);
+
+    m_replay.clear();
+    m_replay_updates = 0;
+    m_replay_from = m_seq.load(std::memory_order_relaxed) + 1;
+    m_seq.store(m_replay_from, std::memory_order_release);
+}
+
+void Server::dispatcher_loop() 
+{
+    while (m_running) 
+    {
+        VecSignal batch;
+
+        {
+            std::unique_lock<std::mutex> lk(m_mtx_queue);
+
+            if (m_queue.Empty() && m_dirty.empty())
+            {
+                // park: from now on producers signal the condition variable
+                m_dispatcher_parked.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                m_cv_queue.wait(lk, [&] 
+                    {
+                        return !m_queue.Empty() || !m_dirty.empty() || m_registry_changed.load(std::memory_order_relaxed) ||
+                            m_schema_changed.load(std::memory_order_relaxed) || !m_running; 
+                    });
+
+                m_dispatcher_parked.store(false, std::memory_order_relaxed);
+            }
+
+            if (!m_dirty.empty())
+            {
+                batch.swap(m_dirty);
+                m_dirty_pos.clear();
+
+                if (m_stats.IsEnabled() && m_dirty_since)
+                {
+                    m_stats.Record(EStage::ingest_wait, PipelineStats::ElapsedNs(m_dirty_since));
+                }
+                m_dirty_since = 0;
+            }
+        }
+
+        // bulk drain of the ring, no lock needed (single consumer)
+        m_popped.clear();
+        m_queue.TryPopBulk(std::back_inserter(m_popped), m_queue.Capacity());
+
+        const bool stats = m_stats.IsEnabled();
+        const int64_t now = stats ? PipelineStats::Now() : 0;
+
+        batch.reserve(batch.size() + m_popped.size());
+        for (const auto& q : m_popped)
+        {
+            batch.push_back(q.signal);
+
+            if (stats && q.enqueued)
+            {
+                m_stats.Record(EStage::ingest_wait, PipelineStats::DeltaNs(q.enqueued, now));
+            }
+        }
+
+        SharedBatch shared_batch;
+        uint64_t seq = 0;
+
+        if (!batch.empty())
+        {
+            shared_batch = std::make_shared<const VecSignal>(std::move(batch));
+
+            // number the updates and keep them for resuming clients before the registry rebuild:
+            // a session registered too late for this batch finds it in the replay ring
+            const uint64_t first_seq = m_seq.load(std::memory_order_relaxed) + 1;
+            seq = first_seq + shared_batch->size() - 1;
+
+            record_replay(first_seq, shared_batch);
+            m_seq.store(seq, std::memory_order_release);
+        }
+
+        // connects / disconnects since the previous batch, in one rebuild
+        // (after the drain, so a session registered before an update was enqueued receives it)
+        if (m_registry_changed.load(std::memory_order_relaxed))
+        {
+            rebuild_subscribers();
+        }
+
+        if (m_fanout_changed.load(std::memory_order_acquire))
+        {
+            swap_fanout_pool();
+        }
+
+        if (shared_batch) 
+        {
+            m_counters.batches.Add();
+            m_counters.batch_updates.Add(shared_batch->size());
+
+            auto subscribers = std::atomic_load(&m_subscribers);
+
+            // encode the batch once per subscription group (mask, wire format),
+            // all sessions of the group enqueue the same payload by reference
+            Payloads payloads;
+            payloads.reserve(subscribers->groups.size());
+            for (const auto& group : subscribers->groups)
+            {
+                int64_t t0 = stats ? PipelineStats::Now() : 0;
+
+                payloads.push_back(make_shared_payload(*shared_batch, group.mask, group.format, FrameSeq{ seq, false }));
+
+                if (stats)
+                {
+                    m_stats.Record(EStage::encode, PipelineStats::ElapsedNs(t0));
+                }
+            }
+
+            int64_t t0 = stats ? PipelineStats::Now() : 0;
+
+            fan_out(*subscribers, shared_batch, seq, payloads);
+
+            if (!subscribers->filtered.empty())
+            {
+                deliver_filtered(*subscribers, *shared_batch, seq);
+            }
+
+            if (stats)
+            {
+                m_stats.Record(EStage::batch_size, shared_batch->size());
+                m_stats.Record(EStage::fan_out, PipelineStats::ElapsedNs(t0));
+            }
+        }
+
+        // signal set changes after the batch: updates of removed ids queued before the change
+        // still reach the sessions ahead of the schema frame, later ones are rejected by the store
+        if (m_schema_changed.load(std::memory_order_relaxed))
+        {
+            apply_schema_ops();
+        }
+    }
+}
+
+void Server::fan_out(const Subscribers& subscribers, const SharedBatch& batch, uint64_t seq, const Payloads& payloads)
+{
+    const size_t cnt_sessions = subscribers.sessions.size();
+    const size_t cnt_workers = m_fanout_pool ? m_fanout_pool->Size() + 1 : 1;
+
+    if (cnt_workers == 1 || cnt_sessions < 2 * MIN_FANOUT_SHARD)
+    {
+        deliver(subscribers, 0, cnt_sessions, batch, seq, payloads);
+        return;
+    }
+
+    // fork: one contiguous shard per worker, the dispatcher thread takes the first one
+    size_t shard = (cnt_sessions + cnt_workers - 1) / cnt_workers;
+    if (shard < MIN_FANOUT_SHARD)
+    {
+        shard = MIN_FANOUT_SHARD;
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t pending = 0;
+
+    for (size_t w = 1, begin = shard; w < cnt_workers && begin < cnt_sessions; w++, begin += shard)
+    {
+        size_t end = std::min(begin + shard, cnt_sessions);
+        pending++;
+
+        asio::post(m_fanout_pool->Get(w - 1), [&, begin, end]()
+            {
+                deliver(subscribers, begin, end, batch, seq, payloads);
+
+                std::lock_guard<std::mutex> lk(mtx);
+                if (--pending == 0)
+                {
+                    cv.notify_one();
+                }
+            });
+    }
+
+    deliver(subscribers, 0, std::min(shard, cnt_sessions), batch, seq, payloads);
+
+    // join: the next batch must not overtake this one in any session
+    std::unique_lock<std::mutex> lk(mtx);
+    cv.wait(lk, [&] { return pending == 0; });
+}
+
+void Server::deliver(const Subscribers& subscribers, size_t begin, size_t end, const SharedBatch& batch, uint64_t seq, const Payloads& payloads)
+{
+    for (size_t g = 0; g < subscribers.groups.size(); g++)
+    {
+        const auto& group = subscribers.groups[g];
+
+        size_t from = std::max(begin, group.begin);
+        size_t to = std::min(end, group.end);
+
+        for (size_t i = from; i < to; i++)
+        {
+            subscribers.sessions[i]->DeliverPayload(payloads[g], batch, seq);
+        }
+    }
+}
+
+void Server::deliver_filtered(const Subscribers& subscribers, const VecSignal& batch, uint64_t seq)
+{
+    // only the subscribers of the changed ids are touched
+    m_filtered_updates.resize(subscribers.filtered.size());
+
+    auto add = [&](uint32_t i, const Signal& s)
+        {
+            if (!((uint8_t)s.type & subscribers.filtered[i].mask))
+            {
+                return;
+            }
+
+            if (m_filtered_updates[i].empty())
+            {
+                m_filtered_touched.push_back(i);
+            }
+            m_filtered_updates[i].push_back(s);
+        };
+
+    for (const auto& s : batch)
+    {
+        auto it = subscribers.by_id.find(s.id);
+        if (it != subscribers.by_id.end())
+        {
+            for (uint32_t i : it->second)
+            {
+                add(i, s);
+            }
+        }
+
+        for (const auto& r : subscribers.wide)
+        {
+            if (s.id >= r.first && s.id <= r.last)
+            {
+                add(r.subscriber, s);
+            }
+        }
+    }
+
+    for (uint32_t i : m_filtered_touched)
+    {
+        const Subscriber& sub = subscribers.filtered[i];
+
+        auto updates = std::make_shared<const VecSignal>(std::move(m_filtered_updates[i]));
+        m_filtered_updates[i].clear();
+
+        sub.session->DeliverPayload(make_shared_payload(*updates, sub.mask, sub.format, FrameSeq{ seq, false }), updates, seq);
+    }
+
+    m_filtered_touched.clear();
+}
+
+void Server::producer_loop()
+{
+    // Currently, this is data emulation. 
+    // It will be replaced with real data ingestion later.
+
+    std::mt19937 rng((unsigned)std::chrono::system_clock::now().time_since_epoch().count());
+
+    std::uniform_int_distribution<int> discret_val(0, 1);
+    std::uniform_real_distribution<double> delta(-0.5, 0.5);
+
+    while (m_running)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(700 + (rng() % 800)));
+
+        int state_size = (int)m_state.Size();
+
+        if (!m_data_emulation || state_size == 0)
+        {
+            continue;
+        }
+
+        std::uniform_int_distribution<int> ids(1, state_size);
+
+        std::uniform_int_distribution<int> cnt_rnd(1, state_size);
+        int cnt = cnt_rnd(rng);
+
+        for (int i = 0; i < cnt; i++)
+        {
+            int id = ids(rng);
+
+            Signal current_s;
+            if (!GetSignal(id, current_s))
+            {
+                continue;
+            }
+
+            // generate new signal
+            Signal new_s = current_s;
+            new_s.value = (new_s.type == ESignalType::discret) ? (discret_val(rng)) : new_s.value + delta(rng);
+            new_s.ts = steady_clock::now();
+
+            PushSignal(new_s);
+        }
+    }
+}
+
+
+void Server::clear_sessions()
+{
+    auto subscribers = std::atomic_load(&m_subscribers);
+
+    for (const auto& sub : subscribers->all)
+    {
+        sub.session->ForceClose();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_subscribers);
+
+        for (const auto& op : m_registry_ops)
+        {
+            if (op.add)
+            {
+                op.subscriber.session->ForceClose();
+            }
+        }
+        m_registry_ops.clear();
+    }
+
+    std::atomic_store(&m_subscribers, std::make_shared<const Subscribers>());
+}
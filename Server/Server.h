@@ -1,23 +1,78 @@
 #pragma once
 
 #include "Session.h"
+#include "SignalStore.h"
+#include "MpscRing.h"
+#include "IoPool.h"
+#include "TimerWheel.h"
+#include "PipelineStats.h"
+#include "Metrics.h"
+#include "MetricsListener.h"
 #include <boost/asio.hpp>
 #include <vector>
+#include <deque>
 #include <unordered_map>
+#include <map>
 #include <mutex>
 #include <memory>
 #include <thread>
 #include <condition_variable>
-#include <deque>
+#include <future>
 #include <atomic>
 #include <random>
-#include <list>
+#include <chrono>
+
+// how PushSignal hands updates to the dispatcher
+enum class EIngestMode
+{
+    queue,      // every accepted update is delivered
+    conflate,   // only the newest value of each changed signal is delivered
+};
+
+
+// how accepted connections are spread over an IoPool
+enum class EAcceptMode
+{
+    round_robin,    // one acceptor, sessions are assigned to the pool contexts in turn
+    reuse_port,     // one SO_REUSEPORT acceptor per context, the kernel balances (Linux; elsewhere round_robin)
+};
+
+
+// per-session outbound queue limits
+struct SlowConsumerPolicy
+{
+    // past these limits a session stops queueing frames and only records which signals changed;
+    // when the socket drains it sends one frame with the current values of those signals
+    size_t max_queue_bytes = 8 * 1024 * 1024;
+    size_t max_queue_frames = 64 * 1024;
+
+    // hard limit: a conflating session whose socket has not drained for this long is disconnected by the
+    // timer wheel, with or without further updates (0 = never)
+    std::chrono::milliseconds max_stall{ 30 * 1000 };
+};
+
+
+// heartbeats and dead peer detection, checked by one timer wheel for all sessions
+struct HeartbeatPolicy
+{
+    // an Alive frame is sent to a subscribed session that had no output for this long (0 = off)
+    std::chrono::milliseconds alive_interval{ 1000 };
+
+    // a session is closed when its write has not completed, or it has not subscribed, for this long (0 = never)
+    std::chrono::milliseconds drain_timeout{ 10 * 1000 };
+
+    // every session is checked once per tick * wheel_slots
+    std::chrono::milliseconds tick{ 50 };
+    size_t wheel_slots = 10;
+};
+
 
 class Server 
 {
 public:
 
     Server(boost::asio::io_context& io, uint16_t port);
+    Server(IoPool& pool, uint16_t port, EAcceptMode mode = EAcceptMode::round_robin);
     virtual ~Server();
 
     // disable copying
@@ -27,43 +82,270 @@ public:
     void Start();
     void Stop();
 
+    uint16_t GetPort() const;
+
      // subscription
-    void RegisterSession(std::shared_ptr<Session> s);
-    void UnregisterExpired();
+    // id_filter: normalized, null = all ids
+    void RegisterSession(std::shared_ptr<Session> s, std::shared_ptr<const VecIdRange> id_filter = nullptr, WireFormat format = WireFormat());
+    void UnregisterSession(std::shared_ptr<Session> s);
+    size_t GetSubscriberCount() const;      // as seen by the dispatcher
 
     // server API
+    // signal set changes are applied by the dispatcher between batches and pushed to live sessions
+    // as schema change frames. Signals passed in take the given value (the last one of a duplicate id),
+    // the others keep their live value.
+    // The calls only queue the change, in call order; the ...AndWait ones return once it (and every
+    // change queued before it) is in the store, so that updates pushed next may use the new ids.
+    // They block on the dispatcher: not from the dispatcher thread or work it waits for (fan-out).
     void SetSignals(const VecSignal signals);
+    void AddSignals(const VecSignal& signals);      // new ids, or a new type / value for an existing id
+    void RemoveSignals(const std::vector<uint32_t>& ids);
+    void SetSignalsAndWait(const VecSignal& signals);
+    void AddSignalsAndWait(const VecSignal& signals);
+    void RemoveSignalsAndWait(const std::vector<uint32_t>& ids);
     bool PushSignal(const Signal& s);
+    std::vector<bool> PushSignals(const Signal* signals, size_t count);     // per-item accept mask
+    std::vector<bool> PushSignals(const VecSignal& signals);
     bool GetSignal(int id, Signal& s);
     VecSignal GetSnapshot(uint8_t type);
 
+    // initial state as data frame payloads of at most GetSnapshotChunk() records each
+    typedef std::shared_ptr<const std::vector<SharedPayload>> SnapshotFrames;
+
+    // initial state of a whole-mask subscription, encoded once and shared by every subscriber
+    // of the same mask and wire format; later subscribers get the updates since appended from the replay ring
+    SnapshotFrames GetSnapshotFrames(uint8_t mask, const WireFormat& format);
+    SnapshotFrames EncodeSnapshot(const VecSignal& signals, uint8_t mask, const WireFormat& format, uint64_t seq = 0) const;
+
+    // one of those frames: the records from begin, which is moved past them (empty when none matched)
+    SharedPayload EncodeSnapshotFrame(const VecSignal& signals, size_t& begin, uint8_t mask, const WireFormat& format, uint64_t seq = 0) const;
+
+    // sequence number of the last update taken by the dispatcher (read it before the store for a snapshot)
+    uint64_t GetSequence() const { return m_seq.load(std::memory_order_acquire); }
+
+    // the updates after seq for a resuming subscriber, as data frames; null when the replay ring no longer
+    // holds all of them or the signal set changed since: the subscriber needs the initial state instead
+    SnapshotFrames GetReplayFrames(uint64_t seq, uint8_t mask, const VecIdRange* ids, const WireFormat& format);
+
+    // for a subscriber that sent the bucket digests of the signals it holds: the data frames of the buckets
+    // that differ from the store; reconcile receives the frame announcing them (data type 0x05, sent first)
+    SnapshotFrames GetReconcileFrames(const std::vector<uint64_t>& digests, uint8_t mask, const VecIdRange* ids, const WireFormat& format, SharedPayload& reconcile);
+
+    // updates kept in the replay ring (0: resuming clients always get the initial state)
+    void SetReplayCapacity(size_t updates) { m_replay_capacity = updates; }
+    size_t GetReplayCapacity() const { return m_replay_capacity; }
+
+    // records per snapshot frame (set before Start())
+    void SetSnapshotChunk(size_t records) { m_snapshot_chunk = records ? records : 1; }
+    size_t GetSnapshotChunk() const { return m_snapshot_chunk; }
+
     void EnableDataEmulation(bool is_enable) { m_data_emulation = is_enable; }
     bool IsEnableDataEmulation(bool is_enable) { return m_data_emulation; }
     void EnableShowLogMsg(bool is_enable) { m_show_log_msg = is_enable; }
     bool IsShowLogMsg() { return m_show_log_msg; }
 
+    // set before Start()
+    void SetSlowConsumerPolicy(const SlowConsumerPolicy& policy) { m_slow_consumer_policy = policy; }
+    const SlowConsumerPolicy& GetSlowConsumerPolicy() const { return m_slow_consumer_policy; }
+
+    void SetHeartbeatPolicy(const HeartbeatPolicy& policy) { m_heartbeat_policy = policy; }
+    const HeartbeatPolicy& GetHeartbeatPolicy() const { return m_heartbeat_policy; }
+
+    // threads sharing the dispatcher fan-out (0/1: all on the dispatcher thread), any time:
+    // the dispatcher takes the new pool before its next batch
+    void SetFanOutThreads(size_t threads);
+
+    void SetIngestMode(EIngestMode mode) { m_ingest_mode = mode; }
+    EIngestMode GetIngestMode() const { return m_ingest_mode; }
+
+    // max bytes gathered from a session write queue into one async_write (at least one frame is always sent)
+    void SetWriteBatchBytes(size_t bytes) { m_write_batch_bytes = bytes; }
+    size_t GetWriteBatchBytes() const { return m_write_batch_bytes; }
+
+    // per-stage latency / size histograms (off by default)
+    void EnableStats(bool is_enable) { m_stats.Enable(is_enable); }
+    PipelineStats& GetStats() { return m_stats; }
+
+    // Prometheus text endpoint (GET /metrics) on a loopback port, served by the server io_context
+    // (set before Start(), port 0: any free port)
+    void EnableMetrics(uint16_t port) { m_metrics_enabled = true; m_metrics_port = port; }
+    uint16_t GetMetricsPort() const;
+    std::string GetMetricsText() const;
+
+    ServerCounters& GetCounters() { return m_counters; }
+
     boost::asio::io_context& GetIoContext() { return m_io; }
+    const SignalStore& GetState() const { return m_state; }
 
 private:
-    void do_accept();
+    struct Subscriber
+    {
+        std::shared_ptr<Session> session;
+        uint8_t mask;
+        std::shared_ptr<const VecIdRange> ids;     // null: all ids of the mask
+        WireFormat format;
+    };
+
+    // immutable subscriber snapshot: strong handles, whole-mask subscribers sorted by mask and wire format,
+    // id-filtered subscribers reached through an id -> subscriber index
+    struct Subscribers
+    {
+        struct Group
+        {
+            uint8_t mask;
+            WireFormat format;
+            size_t begin;   // range in sessions
+            size_t end;
+        };
+
+        struct WideRange
+        {
+            uint32_t first;
+            uint32_t last;
+            uint32_t subscriber;    // index in filtered
+        };
+
+        std::vector<Subscriber> all;
+
+        std::vector<std::shared_ptr<Session>> sessions;
+        std::vector<Group> groups;
+
+        std::vector<Subscriber> filtered;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> by_id;     // id -> indexes in filtered
+        std::vector<WideRange> wide;                                    // ranges too wide to expand into by_id
+    };
+
+    // pending registry change
+    struct RegistryOp
+    {
+        Subscriber subscriber;
+        bool add;
+    };
+
+    // pending signal set change
+    struct SchemaOp
+    {
+        enum Kind { set, add, remove } kind;
+        VecSignal signals;              // set, add
+        std::vector<uint32_t> ids;      // remove
+    };
+
+    typedef std::vector<SharedPayload> Payloads;    // by group
+
+    static const size_t MIN_FANOUT_SHARD = 64;
+    static const uint32_t MAX_EXPANDED_RANGE = 4096;    // wider id ranges are matched by comparison
+    static const size_t MAX_EXPANDED_IDS = 16 * 1024;   // per subscriber in by_id, the other ranges are matched by comparison
+    static const size_t MAX_SESSION_METRICS = 1000;     // per-session series, the max gauges cover all sessions
+
+    void open_acceptor(boost::asio::ip::tcp::acceptor& acceptor, uint16_t port, bool reuse_port);
+    void do_accept(boost::asio::ip::tcp::acceptor& acceptor);
+    bool enqueue(const Signal& s);
+    bool enqueue_conflated(const Signal& s);    // m_mtx_queue must be held
+    bool enqueue_queued(const Signal& s);
+    void wake_dispatcher();
     void dispatcher_loop();
+    void rebuild_subscribers();
+    void swap_fanout_pool();
+    static uint64_t initial_sequence();
+    void record_replay(uint64_t first_seq, const SharedBatch& batch);
+    void reset_replay();
+    SnapshotFrames replay_frames(uint64_t seq, uint8_t mask, const VecIdRange* ids, const WireFormat& format);
+    uint64_t queue_schema_op(SchemaOp op);     // returns its ticket
+    void wait_schema_applied(uint64_t ticket);
+    void apply_schema_ops();
+    void apply_schema(const std::vector<SchemaOp>& ops);
+    void fan_out(const Subscribers& subscribers, const SharedBatch& batch, uint64_t seq, const Payloads& payloads);
+    void deliver(const Subscribers& subscribers, size_t begin, size_t end, const SharedBatch& batch, uint64_t seq, const Payloads& payloads);
+    void deliver_filtered(const Subscribers& subscribers, const VecSignal& batch, uint64_t seq);
     void producer_loop();
     void clear_sessions();
 
 protected:
+    // ingest queue entry
+    struct QueuedSignal
+    {
+        Signal signal;
+        int64_t enqueued;   // steady ticks, only with stats enabled
+    };
+
     boost::asio::io_context& m_io;
     boost::asio::ip::tcp::acceptor m_acceptor;
 
+    IoPool* m_pool{ nullptr };
+    EAcceptMode m_accept_mode{ EAcceptMode::round_robin };
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> m_acceptors_reuse_port;
+
+    // subscriber registry (RCU): the snapshot is replaced as a whole by the dispatcher,
+    // readers only load the pointer; connects / disconnects queue under m_mtx_subscribers
     std::mutex m_mtx_subscribers;
-    std::list<std::weak_ptr<Session>> m_subscribers;
+    std::vector<RegistryOp> m_registry_ops;
+    std::atomic<bool> m_registry_changed{ false };
+    std::shared_ptr<const Subscribers> m_subscribers{ std::make_shared<const Subscribers>() };
+
+    // bumped by the dispatcher whenever it changes the signal set: the replay ring cannot bring
+    // a cached snapshot of an older epoch up to date
+    std::atomic<uint64_t> m_state_epoch{ 0 };
+
+    struct CachedSnapshot
+    {
+        uint64_t epoch;
+        uint64_t seq;           // the store held every update up to it
+        size_t signals;         // in the store then
+        std::shared_future<SnapshotFrames> frames;      // ready once the subscriber that inserted it built it
+    };
+    std::mutex m_mtx_snapshots;
+    std::map<std::pair<uint8_t, WireFormat>, CachedSnapshot> m_snapshots;     // by mask, wire format
+
+    // update sequence numbers, assigned by the dispatcher in batch order; the base is random per
+    // instance, so a restarted server does not reuse the numbers its clients resume from
+    std::atomic<uint64_t> m_seq{ initial_sequence() };
+
+    // replay ring: the latest batches as dispatched, for clients resuming after a short disconnect
+    struct ReplayEntry
+    {
+        uint64_t first_seq;     // of the first update of batch
+        SharedBatch batch;
+    };
+    std::mutex m_mtx_replay;
+    std::deque<ReplayEntry> m_replay;
+    size_t m_replay_updates{ 0 };                   // in m_replay
+    uint64_t m_replay_from{ m_seq.load() };         // every update after this one is in m_replay
+    std::atomic<size_t> m_replay_capacity{ 64 * 1024 };
+
+    // signal set changes, applied by the dispatcher after the batch in flight
+    std::mutex m_mtx_schema;
+    std::condition_variable m_cv_schema;
+    std::vector<SchemaOp> m_schema_ops;
+    uint64_t m_schema_queued{ 0 };      // ops queued / applied so far
+    uint64_t m_schema_applied{ 0 };
+    std::atomic<bool> m_schema_changed{ false };
+
+    // fan-out threads (dispatcher thread only); SetFanOutThreads hands a new pool over under m_mtx_fanout
+    std::unique_ptr<IoPool> m_fanout_pool;
+    std::mutex m_mtx_fanout;
+    std::unique_ptr<IoPool> m_fanout_pending;
+    std::atomic<bool> m_fanout_changed{ false };
 
-    std::mutex m_mtx_state;
-    std::unordered_map<uint32_t, Signal> m_state;
+    // per filtered subscriber updates of the current batch (dispatcher thread only)
+    std::vector<VecSignal> m_filtered_updates;
+    std::vector<uint32_t> m_filtered_touched;
 
-    // signal event queue
+    SignalStore m_state;
+
+    // signal event queue (producers -> dispatcher)
+    static const size_t INGEST_QUEUE_CAPACITY = 64 * 1024;
+    MpscRing<QueuedSignal> m_queue{ INGEST_QUEUE_CAPACITY };
+    std::vector<QueuedSignal> m_popped;     // dispatcher thread only
+
+    // dispatcher parking, conflated updates
     std::mutex m_mtx_queue;
     std::condition_variable m_cv_queue;
-    std::deque<Signal> m_queue;
+    std::atomic<bool> m_dispatcher_parked{ false };
+
+    // conflated updates (EIngestMode::conflate): newest value per changed id, in order of first change
+    VecSignal m_dirty;
+    std::unordered_map<uint32_t, size_t> m_dirty_pos;   // id -> position in m_dirty
+    int64_t m_dirty_since{ 0 };                         // first change of the pending m_dirty (stats)
     std::atomic<bool> m_running{ true };
 
     std::thread m_dispatcher;
@@ -71,5 +353,20 @@ protected:
 
     std::atomic<bool> m_data_emulation{ true };
     std::atomic<bool> m_show_log_msg{ true };
+    std::atomic<EIngestMode> m_ingest_mode{ EIngestMode::queue };
+
+    std::atomic<size_t> m_write_batch_bytes{ 256 * 1024 };
+    size_t m_snapshot_chunk{ 4096 };
+    SlowConsumerPolicy m_slow_consumer_policy;
+
+    PipelineStats m_stats;
+
+    ServerCounters m_counters;
+    bool m_metrics_enabled{ false };
+    uint16_t m_metrics_port{ 0 };
+    std::unique_ptr<MetricsListener> m_metrics;
+
+    HeartbeatPolicy m_heartbeat_policy;
+    std::unique_ptr<TimerWheel> m_wheel;
 
 };
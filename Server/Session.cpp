@@ -4,7 +4,9 @@
 #include "Server.h"
 #include <iostream>
 #include <cstring>
+#include <cstddef>
 #include <cassert>
+#include <algorithm>
 #include <Utils.h>
 
 namespace asio = boost::asio;
@@ -14,12 +16,23 @@ using time_point = std::chrono::steady_clock::time_point;
 using steady_clock = std::chrono::steady_clock;
 
 
+static time_point to_time_point(int64_t ticks)
+{
+    return time_point(steady_clock::duration(ticks));
+}
+
+static std::atomic<uint64_t> g_session_id{ 0 };
+
+
 Session::Session(tcp::socket socket, Server& server)
     : m_socket(std::move(socket))
     , m_strand(asio::make_strand(m_socket.get_executor()))
     , m_server(server)
+    , m_id(++g_session_id)
 {
-    m_time_last_send = steady_clock::now();
+    const int64_t now = steady_clock::now().time_since_epoch().count();
+    m_time_last_send = now;
+    m_time_last_drain = now;
 }
 
 Session::~Session()
@@ -167,80 +180,304 @@ void Session::handle_subscribe(const std::vector<uint8_t>& payload)
         return;
     }
 
-    m_req_type = payload[0];
+    SubscribeRequest req;
+    if (!decode_subscribe(payload, req))
+    {
+        std::cerr << "Session: bad subscribe payload\n";
+        close();
+        return;
+    }
+
+    m_req_type = req.mask;
+    m_wire = req.format;
+
+    std::shared_ptr<const VecIdRange> id_filter;
+    if (req.filter_ids)
+    {
+        id_filter = std::make_shared<const VecIdRange>(std::move(req.id_ranges));
+    }
 
     if (m_server.IsShowLogMsg())
-        std::cout << "Session: client subscribed to type=" << int(m_req_type) << "\n";
+    {
+        std::cout << "Session: client subscribed to type=" << int(m_req_type);
+        if (id_filter)
+            std::cout << ", " << id_filter->size() << " id range(s)";
+        if (m_wire.version != 1)
+            std::cout << ", protocol v" << int(m_wire.version);
+        std::cout << "\n";
+    }
 
-    m_server.RegisterSession(shared_from_this());
+    if (m_closing)
+    {
+        return;
+    }
 
-    // send initial snapshot for this type
-    auto snap = m_server.GetSnapshot(m_req_type);
-    if (!snap.empty())
+    // one subscribe per connection: nothing is read after it, a client changes its subscription by
+    // reconnecting, which also keeps the write queue empty up to here
+    m_server.RegisterSession(shared_from_this(), id_filter, m_wire);
+
+    // send initial snapshot for this type, in bounded frames streamed from here on the strand:
+    // deltas dispatched meanwhile are queued behind them, so they land after the (older) snapshot
+    Server::SnapshotFrames snap;
+    std::shared_ptr<const VecSignal> snap_signals;
+    uint64_t snap_seq = 0;
+    const bool sequenced = m_wire.version >= 2 && (m_wire.options & WIRE_OPT_SEQUENCE);
+
+    if (sequenced && req.resume_seq)
     {
-        DeliverUpdates(snap);
+        // reconnecting client: only the updates it missed, while the replay ring still has them
+        snap = m_server.GetReplayFrames(req.resume_seq, m_req_type, id_filter.get(), m_wire);
+
+        if (m_server.IsShowLogMsg())
+            std::cout << "Session: resume from " << req.resume_seq << (snap ? ", replaying" : ", too old, sending the snapshot") << "\n";
     }
+
+    if (!snap && sequenced && !req.digests.empty())
+    {
+        // client holding a state of its own: only the buckets that differ from the store
+        SharedPayload reconcile;
+        snap = m_server.GetReconcileFrames(req.digests, m_req_type, id_filter.get(), m_wire, reconcile);
+        enqueue_frame(reconcile, 0x05);
+
+        if (m_server.IsShowLogMsg())
+            std::cout << "Session: reconcile, " << (reconcile->size() / 4 - 1) << " of " << req.digests.size() << " buckets differ\n";
+    }
+
+    if (!snap && id_filter)
+    {
+        // own records, encoded chunk by chunk as the socket drains
+        snap_seq = m_server.GetSequence();
+
+        auto signals = std::make_shared<VecSignal>(m_server.GetSnapshot(m_req_type));
+        signals->erase(std::remove_if(signals->begin(), signals->end(), [&](const Signal& s) { return !id_in_ranges(*id_filter, s.id); }), signals->end());
+        snap_signals = std::move(signals);
+    }
+    else if (!snap)
+    {
+        // whole mask: the frames are shared with the other subscribers of this mask and format
+        snap = m_server.GetSnapshotFrames(m_req_type, m_wire);
+    }
+
+    m_snap_frames = std::move(snap);
+    m_snap_signals = std::move(snap_signals);
+    m_snap_seq = snap_seq;
+    m_snap_next = 0;
+
+    const int64_t now = steady_clock::now().time_since_epoch().count();
+
+    if (m_que_sending.empty())
+    {
+        m_time_last_drain = now;
+        do_write();
+    }
+
+    // heartbeats start after the snapshot is queued, so it stays the first frame
+    m_time_last_send = now;
+    m_registered = true;
 }
 
 void Session::DeliverUpdates(const VecSignal& updates)
 {
+    auto batch = std::make_shared<const VecSignal>(updates);
+    DeliverPayload(make_shared_payload(*batch, m_req_type, m_wire), batch);
+}
+
+void Session::DeliverPayload(SharedPayload payload, SharedBatch batch, uint64_t seq)
+{
+    if (payload->empty())
+    {
+        return;
+    }
+
+    PipelineStats& stats = m_server.GetStats();
+    const int64_t posted = stats.IsEnabled() ? PipelineStats::Now() : 0;
+
     auto self = shared_from_this();
-    asio::post(m_strand, [this, self, updates]() 
+    asio::post(m_strand, [this, self, payload = std::move(payload), batch = std::move(batch), seq, posted]() mutable
         {
+            if (posted)
+            {
+                m_server.GetStats().Record(EStage::session_wait, PipelineStats::ElapsedNs(posted));
+            }
+
             if (!m_socket.is_open()) 
             {
                 return;
             }
 
-            std::vector<uint8_t> payload;
-            payload.reserve(updates.size() * (4 + 1 + 8));
+            const SlowConsumerPolicy& policy = m_server.GetSlowConsumerPolicy();
+            size_t cnt_frames = m_que_write.size() + m_que_sending.size();
 
-            for (const auto& e : updates)
+            if (!m_conflating && cnt_frames != 0 &&
+                (m_queued_bytes + payload->size() > policy.max_queue_bytes || cnt_frames >= policy.max_queue_frames))
             {
-                if (!((uint8_t)e.type & m_req_type))
-                {
-                    continue;
-                }
+                // slow consumer: stop queueing, remember the changed signals until the socket drains
+                // (a frame is always accepted into an empty queue, so a write is in flight to end this)
+                m_conflating = true;
+                m_dirty_bits.assign((m_server.GetState().Size() + 63) / 64, 0);
+                m_server.GetCounters().slow_consumer_events.Add();
+
+                if (m_server.IsShowLogMsg())
+                    std::cout << "Session: slow consumer, conflating updates\n";
+            }
 
-                // id
-                uint32_t idSignal = host_to_net_u32(e.id);
-                payload.insert(payload.end(), (uint8_t*)&idSignal, (uint8_t*)&idSignal + 4);
+            if (m_conflating)
+            {
+                // (a consumer stalled for too long is closed by the timer wheel, CheckTimeouts)
+                mark_dirty(*batch);
+                m_dirty_seq = seq;
+                return;
+            }
 
-                // type 
-                payload.push_back(static_cast<uint8_t>(e.type));
+            enqueue_frame(std::move(payload));
+        });
+}
 
-                // value
-                uint64_t value; 
-                static_assert(sizeof(value) == sizeof(e.value), "double size mismatch");
-                std::memcpy(&value, &e.value, sizeof(value));
-                value = host_to_net_u64(value);
-                payload.insert(payload.end(), (uint8_t*)&value, (uint8_t*)&value + 8);
+void Session::DeliverSchema(SharedPayload payload)
+{
+    auto self = shared_from_this();
+    asio::post(m_strand, [this, self, payload = std::move(payload)]() mutable
+        {
+            if (!m_socket.is_open())
+            {
+                return;
             }
 
-            SSignalProtocolHeader hdr;
-            hdr.signature = host_to_net_u16(SIGNAL_HEADER_SIGNATURE);
-            hdr.version = 1;
-            hdr.data_type = 0x02;
-            hdr.msg_num = m_msg_num++;
-            hdr.len = host_to_net_u32(static_cast<uint32_t>(payload.size()));
-
-            auto frame = std::make_shared<std::vector<uint8_t>>();
-            frame->resize(sizeof(hdr) + payload.size());
-            std::memcpy(frame->data(), &hdr, sizeof(hdr));
-            if (!payload.empty())
+            if (m_conflating)
             {
-                std::memcpy(frame->data() + sizeof(hdr), payload.data(), payload.size());
+                // the changed-signal bits are keyed by store slots, which the new set renumbers:
+                // a slow consumer resynchronizes by reconnecting
+                if (m_server.IsShowLogMsg())
+                    std::cout << "Session: signal set changed while conflating, closing\n";
+
+                close();
+                return;
             }
 
-            bool need_start = m_que_write.empty() /*&& !m_writing*/;
-            m_que_write.push_back(frame);
-            if (need_start)
+            enqueue_frame(std::move(payload), 0x04);
+        });
+}
+
+void Session::enqueue_frame(SharedPayload payload, uint8_t data_type)
+{
+    OutFrame frame;
+    SSignalProtocolHeader hdr = make_header(data_type, 0, static_cast<uint32_t>(payload->size()), m_wire.version);
+    std::memcpy(frame.header.data(), &hdr, sizeof(hdr));
+    frame.payload = std::move(payload);
+
+    m_queued_bytes += frame.header.size() + frame.payload->size();
+    m_que_write.push_back(std::move(frame));
+    publish_queue_depth();
+
+    const int64_t now = steady_clock::now().time_since_epoch().count();
+
+    if (m_que_sending.empty())
+    {
+        m_time_last_drain = now;
+        do_write();
+    }
+
+    m_time_last_send = now;
+}
+
+void Session::mark_dirty(const VecSignal& updates)
+{
+    const SignalStore& state = m_server.GetState();
+
+    for (const auto& e : updates)
+    {
+        uint32_t slot;
+        if (((uint8_t)e.type & m_req_type) && state.Find(e.id, slot) && slot / 64 < m_dirty_bits.size())
+        {
+            m_dirty_bits[slot / 64] |= uint64_t(1) << (slot % 64);
+        }
+    }
+}
+
+void Session::flush_dirty()
+{
+    // one consolidated frame with the current values of the signals changed while conflating
+    const SignalStore& state = m_server.GetState();
+
+    auto batch = std::make_shared<VecSignal>();
+    Signal s;
+
+    for (size_t i = 0; i < m_dirty_bits.size(); i++)
+    {
+        uint64_t bits = m_dirty_bits[i];
+        while (bits)
+        {
+            uint32_t slot = static_cast<uint32_t>(i * 64 + count_trailing_zeros_u64(bits));
+            bits &= bits - 1;
+
+            if (state.GetSlot(slot, s))
             {
-                do_write();
+                batch->push_back(s);
             }
+        }
+    }
 
-            m_time_last_send = steady_clock::now();
-        });
+    m_conflating = false;
+    m_dirty_bits.clear();
+    m_dirty_bits.shrink_to_fit();
+
+    // the frame brings the client up to the last conflated batch: a v2 client keeps its resume position
+    // (a batch still on its way to the strand follows with its own number)
+    SharedPayload payload = make_shared_payload(*batch, m_req_type, m_wire, FrameSeq{ m_dirty_seq, false });
+    if (payload->empty() && m_dirty_seq && m_wire.version >= 2 && (m_wire.options & WIRE_OPT_SEQUENCE))
+    {
+        payload = make_position_payload(m_dirty_seq);
+    }
+    m_dirty_seq = 0;
+
+    if (!payload->empty())
+    {
+        enqueue_frame(std::move(payload));
+    }
+}
+
+void Session::publish_queue_depth()
+{
+    m_stat_queued_bytes.store(m_queued_bytes, std::memory_order_relaxed);
+    m_stat_queued_frames.store(m_que_write.size() + m_que_sending.size(), std::memory_order_relaxed);
+}
+
+bool Session::next_snapshot_frame(OutFrame& frame)
+{
+    while (snapshot_pending())
+    {
+        SharedPayload payload;
+
+        if (m_snap_frames)
+        {
+            if (m_snap_next < m_snap_frames->size())
+            {
+                payload = (*m_snap_frames)[m_snap_next++];
+            }
+            if (m_snap_next >= m_snap_frames->size())
+            {
+                m_snap_frames.reset();
+            }
+        }
+        else
+        {
+            payload = m_server.EncodeSnapshotFrame(*m_snap_signals, m_snap_next, m_req_type, m_wire, m_snap_seq);
+            if (m_snap_next >= m_snap_signals->size())
+            {
+                m_snap_signals.reset();
+            }
+        }
+
+        if (payload && !payload->empty())
+        {
+            SSignalProtocolHeader hdr = make_header(0x02, 0, static_cast<uint32_t>(payload->size()), m_wire.version);
+            std::memcpy(frame.header.data(), &hdr, sizeof(hdr));
+            frame.payload = std::move(payload);
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void Session::do_write()
@@ -248,21 +485,98 @@ void Session::do_write()
     if (!m_socket.is_open())
     {
         m_que_write.clear();
+        m_snap_frames.reset();
+        m_snap_signals.reset();
         return;
     }
 
-    if (m_que_write.empty())
+    // gather everything queued (up to the byte cap) into one scatter/gather write,
+    // frames in flight stay in m_que_sending until completion, so the buffers remain valid
+    const size_t max_bytes = m_server.GetWriteBatchBytes();
+    size_t bytes = 0;
+
+    m_buf_sending.clear();
+
+    auto send = [&](OutFrame&& frame)
+        {
+            const size_t frame_size = frame.header.size() + frame.payload->size();
+
+            // numbered in write order: a snapshot frame overtakes the frames queued after the subscribe
+            frame.header[offsetof(SSignalProtocolHeader, msg_num)] = m_msg_num++;
+
+            m_que_sending.push_back(std::move(frame));
+            m_sending_bytes += frame_size;
+
+            const OutFrame& sending = m_que_sending.back();
+            m_buf_sending.push_back(asio::buffer(sending.header));
+            m_buf_sending.push_back(asio::buffer(*sending.payload));
+            bytes += frame_size;
+        };
+
+    OutFrame snap_frame;
+    if (next_snapshot_frame(snap_frame))
+    {
+        // a snapshot frame goes alone and counts only while in flight: the next one is encoded when this
+        // write completes, so a large snapshot neither piles up in memory nor trips the slow-consumer limits
+        m_queued_bytes += snap_frame.header.size() + snap_frame.payload->size();
+        send(std::move(snap_frame));
+    }
+    else
+    {
+        while (!m_que_write.empty())
+        {
+            OutFrame& frame = m_que_write.front();
+            size_t frame_size = frame.header.size() + frame.payload->size();
+
+            if (snapshot_pending() || (!m_que_sending.empty() && bytes + frame_size > max_bytes))
+            {
+                break;
+            }
+
+            send(std::move(frame));
+            m_que_write.pop_front();
+        }
+    }
+
+    if (m_que_sending.empty())
     {
         return;
     }
 
-    auto frame = m_que_write.front();
+    publish_queue_depth();
+
     auto self = shared_from_this();
 
-    asio::async_write(m_socket, asio::buffer(*frame),
+    m_writing = true;
+
+    const int64_t started = m_server.GetStats().IsEnabled() ? PipelineStats::Now() : 0;
+
+    asio::async_write(m_socket, m_buf_sending,
         asio::bind_executor(m_strand,
-            [this, self, frame](error_code ec, std::size_t /*n*/) 
+            [this, self, started](error_code ec, std::size_t n) 
             {
+                if (started)
+                {
+                    PipelineStats& stats = m_server.GetStats();
+                    stats.Record(EStage::socket_write, PipelineStats::ElapsedNs(started));
+                    stats.Record(EStage::write_bytes, n);
+                }
+
+                if (!ec)
+                {
+                    ServerCounters& counters = m_server.GetCounters();
+                    counters.frames_sent.Add(m_que_sending.size());
+                    counters.bytes_sent.Add(n);
+                }
+
+                m_que_sending.clear();
+                m_buf_sending.clear();
+                m_queued_bytes -= m_sending_bytes;
+                m_sending_bytes = 0;
+                m_time_last_drain = steady_clock::now().time_since_epoch().count();
+                m_writing = false;
+                publish_queue_depth();
+
                 if (ec)
                 {
                     if (ec == asio::error::connection_reset ||
@@ -284,11 +598,13 @@ void Session::do_write()
                     return;
                 }
 
-                // remove sent frame and continue
-                m_que_write.pop_front();
-                if (!m_que_write.empty())
+                // continue with the snapshot and the frames queued meanwhile
+                do_write();
+
+                if (m_que_sending.empty() && m_conflating)
                 {
-                    do_write();
+                    // socket drained: catch up the slow consumer
+                    flush_dirty();
                 }
             }));
 }
@@ -298,6 +614,8 @@ void Session::close()
     if (m_closing.exchange(true))
         return;
 
+    m_server.GetCounters().sessions_closed.Add();
+
     error_code ec;
     if (m_socket.is_open())
     {
@@ -307,9 +625,19 @@ void Session::close()
 
     // clear queued frames on the strand to avoid races
     auto self = shared_from_this();
+
+    if (m_registered)
+    {
+        m_registered = false;
+        m_server.UnregisterSession(self);
+    }
     asio::post(m_strand, [this, self]() 
         {
             m_que_write.clear();
+            m_snap_frames.reset();
+            m_snap_signals.reset();
+            m_queued_bytes = m_sending_bytes;
+            publish_queue_depth();
 
             m_self.reset();
         });
@@ -317,6 +645,65 @@ void Session::close()
     //std::cout << "Session closed\n";
 }
 
+bool Session::CheckTimeouts(time_point now, const HeartbeatPolicy& policy)
+{
+    if (m_closing)
+    {
+        return false;
+    }
+
+    // reap: a write that does not complete (dead or stalled peer), or no subscription at all
+    if (policy.drain_timeout.count() && (m_writing || !m_registered) && 
+        now - to_time_point(m_time_last_drain) > policy.drain_timeout)
+    {
+        if (m_server.IsShowLogMsg())
+            std::cout << "Session: " << (m_writing ? "peer not draining" : "no subscription") << ", closing\n";
+
+        ForceClose();
+        return false;
+    }
+
+    // hard limit for a slow consumer: conflating, and its socket has not drained for max_stall
+    const SlowConsumerPolicy& slow = m_server.GetSlowConsumerPolicy();
+    if (slow.max_stall.count() && m_conflating && now - to_time_point(m_time_last_drain) > slow.max_stall)
+    {
+        if (m_server.IsShowLogMsg())
+            std::cout << "Session: consumer stalled, closing\n";
+
+        ForceClose();
+        return false;
+    }
+
+    // heartbeat for an idle subscriber
+    if (policy.alive_interval.count() && m_registered && !m_writing &&
+        now - to_time_point(m_time_last_send) >= policy.alive_interval)
+    {
+        auto self = shared_from_this();
+        asio::post(m_strand, [this, self]()
+            {
+                // only if nothing else went out meanwhile
+                if (m_socket.is_open() && m_que_write.empty() && m_que_sending.empty())
+                {
+                    static const SharedPayload empty = std::make_shared<const std::vector<uint8_t>>();
+                    enqueue_frame(empty, 0x03);
+                }
+            });
+    }
+
+    return true;
+}
+
+steady_clock::duration Session::GetLag(time_point now) const
+{
+    if (!m_writing)
+    {
+        return steady_clock::duration::zero();
+    }
+
+    auto lag = now - to_time_point(m_time_last_drain);
+    return lag > steady_clock::duration::zero() ? lag : steady_clock::duration::zero();
+}
+
 bool Session::Expired() const
 {
     return !m_socket.is_open();
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <Protocol.h>
+#include <Codec.h>
 #include <boost/asio.hpp>
+#include <array>
+#include <atomic>
 #include <deque>
 #include <vector>
 #include <memory>
@@ -9,6 +12,10 @@
 
 
 class Server;
+struct HeartbeatPolicy;
+
+// updates behind a shared payload, used to track changed signals while a session is conflating
+typedef std::shared_ptr<const VecSignal> SharedBatch;
 
 
 class Session : public std::enable_shared_from_this<Session> 
@@ -21,14 +28,36 @@ public:
 
     void Start();
     void DeliverUpdates(const VecSignal& updates);
+    void DeliverPayload(SharedPayload payload, SharedBatch batch, uint64_t seq = 0);    // seq: of the last update in batch
+    void DeliverSchema(SharedPayload payload);     // schema change frame, never conflated
+    uint8_t GetReqType() const { return m_req_type; }
     bool Expired() const;
+
+    // metrics (any thread, relaxed)
+    uint64_t GetId() const { return m_id; }
+    size_t GetQueuedBytes() const { return m_stat_queued_bytes.load(std::memory_order_relaxed); }
+    size_t GetQueuedFrames() const { return m_stat_queued_frames.load(std::memory_order_relaxed); }
+    std::chrono::steady_clock::duration GetLag(std::chrono::steady_clock::time_point now) const;    // age of the undrained write, 0 when idle
+
+    // timer wheel check (any thread): send Alive when idle, close a stalled, unsubscribed or
+    // too long conflating session;
+    // false once the session is closing
+    bool CheckTimeouts(std::chrono::steady_clock::time_point now, const HeartbeatPolicy& policy);
     void ForceClose();
 
 private:
+    struct OutFrame;
+
     void async_read_header();
     void async_read_body(std::size_t len, uint8_t data_type);
     void handle_subscribe(const std::vector<uint8_t>& payload);
     void do_write();
+    void enqueue_frame(SharedPayload payload, uint8_t data_type = 0x02);
+    bool next_snapshot_frame(OutFrame& frame);
+    bool snapshot_pending() const { return m_snap_frames || m_snap_signals; }
+    void mark_dirty(const VecSignal& updates);
+    void flush_dirty();
+    void publish_queue_depth();
     void close();
 
 private:
@@ -36,22 +65,58 @@ private:
     using SessionStrand = boost::asio::strand<SocketExecutor>;
     using time_point = std::chrono::steady_clock::time_point;
 
+    // queued frame: per-session header (msg_num set when it is written) + shared payload
+    struct OutFrame
+    {
+        std::array<uint8_t, sizeof(SSignalProtocolHeader)> header;
+        SharedPayload payload;
+    };
+
     tcp::socket m_socket;
 
     SessionStrand m_strand;
 
     Server& m_server;
 
+    const uint64_t m_id;
+
     std::array<uint8_t, sizeof(SSignalProtocolHeader)> m_buf_header;
     std::vector<uint8_t> m_buf_body;
 
-    std::deque<std::shared_ptr<std::vector<uint8_t>>> m_que_write;
+    std::deque<OutFrame> m_que_write;       // frames waiting for write
+    std::deque<OutFrame> m_que_sending;     // frames in the current async_write
+    std::vector<boost::asio::const_buffer> m_buf_sending;
+    size_t m_queued_bytes{ 0 };             // m_que_write + m_que_sending
+    size_t m_sending_bytes{ 0 };
+
+    // initial state still to send: one frame per write, encoded as the socket drains and kept out of
+    // the slow-consumer limits; the deltas queued meanwhile wait behind it
+    std::shared_ptr<const std::vector<SharedPayload>> m_snap_frames;   // encoded frames, or
+    std::shared_ptr<const VecSignal> m_snap_signals;                   // records encoded chunk by chunk
+    size_t m_snap_next{ 0 };        // frame / record index
+    uint64_t m_snap_seq{ 0 };
+
+    // m_queued_bytes and the frame count, published for the metrics endpoint
+    std::atomic<size_t> m_stat_queued_bytes{ 0 };
+    std::atomic<size_t> m_stat_queued_frames{ 0 };
 
-    uint8_t m_req_type{ 0 };
+    // slow consumer: changed signals (bit per store slot) while the queue is over its limits,
+    // and the sequence number of the last update marked (written on the strand, read by the timer wheel)
+    std::atomic<bool> m_conflating{ false };
+    std::vector<uint64_t> m_dirty_bits;
+    uint64_t m_dirty_seq{ 0 };
+
+    std::atomic<uint8_t> m_req_type{ 0 };
+    WireFormat m_wire;                      // data frame encoding (strand only)
 
     uint8_t m_msg_num{ 0 };
 
-    time_point m_time_last_send;
+    // steady_clock ticks, written on the strand, read by the timer wheel
+    std::atomic<int64_t> m_time_last_send{ 0 };
+    std::atomic<int64_t> m_time_last_drain{ 0 };   // last write completion (or start of the current write queue)
+    std::atomic<bool> m_writing{ false };           // async_write in flight
+
+    std::atomic<bool> m_registered{ false };    // in the server registry (written on the strand)
 
     std::shared_ptr<Session> m_self;          // keep the self-pointer while the session is active
     std::atomic<bool> m_closing{ false };
@@ -0,0 +1,269 @@
+// SignalStore.cpp
+
+#include "SignalStore.h"
+#include <cstring>
+#include <thread>
+
+using steady_clock = std::chrono::steady_clock;
+
+
+// shard of the read section counters for the calling thread, spread round-robin
+static size_t reader_shard(size_t shards)
+{
+    static std::atomic<size_t> next{ 0 };
+    thread_local const size_t shard = next.fetch_add(1, std::memory_order_relaxed);
+
+    return shard % shards;
+}
+
+
+SignalStore::ReadSection::ReadSection(const SignalStore& store)
+{
+    ReaderShard& shard = store.m_readers[reader_shard(READER_SHARDS)];
+
+    // register in the current generation; if Reset() moved on meanwhile, register in the new one,
+    // whose table was published before the generation changed
+    while (true)
+    {
+        const uint32_t generation = store.m_generation.load(std::memory_order_seq_cst);
+
+        m_active = &shard.active[generation & 1];
+        m_active->fetch_add(1, std::memory_order_seq_cst);
+
+        if (store.m_generation.load(std::memory_order_seq_cst) == generation)
+        {
+            break;
+        }
+        m_active->fetch_sub(1, std::memory_order_release);
+    }
+
+    m_table = store.m_table.load(std::memory_order_acquire);
+}
+
+SignalStore::ReadSection::~ReadSection()
+{
+    m_active->fetch_sub(1, std::memory_order_release);
+}
+
+
+SignalStore::SignalStore()
+{
+    Reset(VecSignal());
+}
+
+void SignalStore::Reset(const VecSignal& signals, const std::vector<uint32_t>& carry_ids)
+{
+    auto table = std::make_unique<Table>(signals.size());
+
+    uint32_t cnt = 0;
+    for (const auto& s : signals)
+    {
+        auto it = table->index.emplace(s.id, cnt);
+        if (it.second)
+        {
+            cnt++;
+        }
+
+        Slot& slot = table->slots[it.first->second];
+
+        uint64_t value;
+        std::memcpy(&value, &s.value, sizeof(value));
+
+        slot.id = s.id;
+        slot.type.store(static_cast<uint8_t>(s.type), std::memory_order_relaxed);
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.ts.store(s.ts.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    table->size = cnt;
+
+    std::lock_guard<std::mutex> lk(m_mtx_reset);
+
+    std::unique_ptr<Table> old = std::move(m_owned);
+    m_owned = std::move(table);
+    m_table.store(m_owned.get(), std::memory_order_seq_cst);
+
+    if (!old)
+    {
+        return;
+    }
+
+    // grace period: sections from now on see the new table, wait for those that may hold the old one
+    const uint32_t generation = m_generation.fetch_add(1, std::memory_order_seq_cst);
+
+    for (auto& shard : m_readers)
+    {
+        while (shard.active[generation & 1].load(std::memory_order_acquire) != 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // every update of the old table has completed: carry the live values over
+    Signal s;
+    for (uint32_t id : carry_ids)
+    {
+        auto from = old->index.find(id);
+        auto to = m_owned->index.find(id);
+        if (from == old->index.end() || to == m_owned->index.end())
+        {
+            continue;
+        }
+
+        read_slot(old->slots[from->second], s);
+
+        Slot& slot = m_owned->slots[to->second];
+        if ((uint8_t)s.type == slot.type.load(std::memory_order_relaxed))
+        {
+            write_slot(slot, s);
+        }
+    }
+}
+
+bool SignalStore::Update(const Signal& s)
+{
+    ReadSection t(*this);
+
+    auto it = t->index.find(s.id);
+    if (it == t->index.end())
+    {
+        return false;
+    }
+
+    return write_slot(t->slots[it->second], s);
+}
+
+bool SignalStore::write_slot(Slot& slot, const Signal& s)
+{
+    const int64_t ts = s.ts.time_since_epoch().count();
+
+    // lock the slot: even -> odd
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    while (true)
+    {
+        if (seq & 1)
+        {
+            std::this_thread::yield();
+            seq = slot.seq.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        if (slot.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    bool updated = false;
+    if (ts >= slot.ts.load(std::memory_order_relaxed))
+    {
+        uint64_t value;
+        std::memcpy(&value, &s.value, sizeof(value));
+
+        slot.type.store(static_cast<uint8_t>(s.type), std::memory_order_relaxed);
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.ts.store(ts, std::memory_order_relaxed);
+        updated = true;
+    }
+
+    // unlock: odd -> even
+    slot.seq.store(seq + 2, std::memory_order_release);
+
+    return updated;
+}
+
+void SignalStore::read_slot(const Slot& slot, Signal& s)
+{
+    while (true)
+    {
+        uint32_t seq1 = slot.seq.load(std::memory_order_acquire);
+        if (seq1 & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        uint8_t type = slot.type.load(std::memory_order_relaxed);
+        uint64_t value = slot.value.load(std::memory_order_relaxed);
+        int64_t ts = slot.ts.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot.seq.load(std::memory_order_relaxed) == seq1)
+        {
+            s.id = slot.id;
+            s.type = static_cast<ESignalType>(type);
+            std::memcpy(&s.value, &value, sizeof(value));
+            s.ts = Signal::time_point(steady_clock::duration(ts));
+            return;
+        }
+    }
+}
+
+bool SignalStore::Get(uint32_t id, Signal& s) const
+{
+    ReadSection t(*this);
+
+    auto it = t->index.find(id);
+    if (it == t->index.end())
+    {
+        return false;
+    }
+
+    read_slot(t->slots[it->second], s);
+    return true;
+}
+
+VecSignal SignalStore::Snapshot(uint8_t type) const
+{
+    ReadSection t(*this);
+
+    VecSignal out;
+    out.reserve(t->size);
+
+    Signal s;
+    for (size_t i = 0; i < t->size; i++)
+    {
+        read_slot(t->slots[i], s);
+
+        if ((uint8_t)s.type & type)
+        {
+            out.push_back(s);
+        }
+    }
+
+    return out;
+}
+
+size_t SignalStore::Size() const
+{
+    ReadSection t(*this);
+    return t->size;
+}
+
+bool SignalStore::Find(uint32_t id, uint32_t& slot) const
+{
+    ReadSection t(*this);
+
+    auto it = t->index.find(id);
+    if (it == t->index.end())
+    {
+        return false;
+    }
+
+    slot = it->second;
+    return true;
+}
+
+bool SignalStore::GetSlot(uint32_t slot, Signal& s) const
+{
+    ReadSection t(*this);
+
+    if (slot >= t->size)
+    {
+        return false;
+    }
+
+    read_slot(t->slots[slot], s);
+    return true;
+}
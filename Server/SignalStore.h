@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Protocol.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+// Signal state store.
+// Every id is interned to a dense, cache-line aligned slot protected by its own seqlock:
+// readers never take a lock (they retry while a writer of the same slot is active) and
+// writers contend only when they update the same signal.
+// The id -> slot table is immutable; Reset() publishes a new one. Every access runs in a short read
+// section counted per store (in one of a few per-thread shards of two generations), and Reset() frees
+// the old table once the sections of its generation have ended: no thread keeps a reference to a table
+// between calls, and an Update() racing with Reset() has finished before its value is carried over.
+class SignalStore
+{
+public:
+    SignalStore();
+
+    // disable copying
+    SignalStore(const SignalStore&) = delete;
+    SignalStore& operator=(const SignalStore&) = delete;
+
+    // replace the signal set; the live values of carry ids that keep their type are copied
+    // over after the switch, including updates that still went to the old table
+    void Reset(const VecSignal& signals, const std::vector<uint32_t>& carry_ids = {});
+
+    // store s if the id is known and s is not older than the stored value
+    bool Update(const Signal& s);
+
+    bool Get(uint32_t id, Signal& s) const;
+    VecSignal Snapshot(uint8_t type) const;
+    size_t Size() const;
+
+    // dense slot numbers (0..Size()-1) for per-signal bitmaps, valid until Reset()
+    bool Find(uint32_t id, uint32_t& slot) const;
+    bool GetSlot(uint32_t slot, Signal& s) const;
+
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic<uint32_t> seq{ 0 };     // odd while a writer is active
+        uint32_t id{ 0 };
+        std::atomic<uint8_t> type{ 0 };
+        std::atomic<uint64_t> value{ 0 };   // double bits
+        std::atomic<int64_t> ts{ 0 };       // steady_clock ticks
+    };
+
+    struct Table
+    {
+        explicit Table(size_t n) : slots(new Slot[n]), size(n) {}
+
+        std::unique_ptr<Slot[]> slots;
+        size_t size;
+        std::unordered_map<uint32_t, uint32_t> index;  // id -> slot
+    };
+
+    static const size_t READER_SHARDS = 64;
+
+    // read sections in progress, per generation
+    struct alignas(64) ReaderShard
+    {
+        std::atomic<uint32_t> active[2]{};
+    };
+
+    // the current table for the lifetime of the section
+    class ReadSection
+    {
+    public:
+        explicit ReadSection(const SignalStore& store);
+        ~ReadSection();
+
+        ReadSection(const ReadSection&) = delete;
+        ReadSection& operator=(const ReadSection&) = delete;
+
+        const Table* operator->() const { return m_table; }
+        const Table& operator*() const { return *m_table; }
+
+    private:
+        std::atomic<uint32_t>* m_active;
+        const Table* m_table;
+    };
+
+    static void read_slot(const Slot& slot, Signal& s);
+    static bool write_slot(Slot& slot, const Signal& s);       // if s is not older
+
+private:
+    std::mutex m_mtx_reset;                         // one Reset() at a time
+    std::unique_ptr<Table> m_owned;                 // the current table
+    std::atomic<const Table*> m_table{ nullptr };
+    std::atomic<uint32_t> m_generation{ 0 };
+    mutable ReaderShard m_readers[READER_SHARDS];
+};
@@ -0,0 +1,90 @@
+// TimerWheel.cpp
+
+#include "TimerWheel.h"
+
+namespace asio = boost::asio;
+using error_code = boost::system::error_code;
+using steady_clock = std::chrono::steady_clock;
+
+
+TimerWheel::TimerWheel(asio::io_context& io, std::chrono::milliseconds tick, size_t slots)
+    : m_timer(io), m_tick(tick), m_slots(slots ? slots : 1)
+{
+}
+
+void TimerWheel::Start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+
+    m_timer.expires_after(m_tick);
+    schedule();
+}
+
+void TimerWheel::Stop()
+{
+    m_running = false;
+    m_timer.cancel();
+}
+
+void TimerWheel::Add(Callback cb)
+{
+    std::lock_guard<std::mutex> lk(m_mtx_added);
+
+    m_added.push_back(std::move(cb));
+    m_size++;
+}
+
+void TimerWheel::schedule()
+{
+    m_timer.async_wait([this](const error_code& ec)
+        {
+            if (ec == asio::error::operation_aborted || !m_running)
+            {
+                return;
+            }
+
+            on_tick();
+
+            // fixed rate, a late tick does not shift the following ones
+            m_timer.expires_at(m_timer.expiry() + m_tick);
+            schedule();
+        });
+}
+
+void TimerWheel::on_tick()
+{
+    std::vector<Callback> added;
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_added);
+        added.swap(m_added);
+    }
+
+    // new entries are hashed round-robin, so every slot carries the same share
+    for (auto& cb : added)
+    {
+        m_slots[m_next_slot].push_back(std::move(cb));
+        m_next_slot = (m_next_slot + 1) % m_slots.size();
+    }
+
+    const time_point now = steady_clock::now();
+    auto& slot = m_slots[m_cursor];
+
+    for (size_t i = 0; i < slot.size();)
+    {
+        if (slot[i](now))
+        {
+            i++;
+            continue;
+        }
+
+        // unordered remove
+        slot[i] = std::move(slot.back());
+        slot.pop_back();
+        m_size--;
+    }
+
+    m_cursor = (m_cursor + 1) % m_slots.size();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+
+// Hashed timer wheel driven by a single steady_timer.
+// Entries are spread over the slots; every tick visits one slot, so each entry is
+// visited once per revolution (tick * slots) and a tick costs size / slots callbacks.
+class TimerWheel
+{
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    // called on the wheel context once per revolution, false: remove the entry
+    typedef std::function<bool(time_point now)> Callback;
+
+    TimerWheel(boost::asio::io_context& io, std::chrono::milliseconds tick, size_t slots);
+
+    // disable copying
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    void Start();
+    void Stop();
+
+    // any thread; the entry joins the wheel with the next tick
+    void Add(Callback cb);
+    size_t Size() const { return m_size; }
+
+    std::chrono::milliseconds Revolution() const { return m_tick * m_slots.size(); }
+
+private:
+    void schedule();
+    void on_tick();
+
+private:
+    boost::asio::steady_timer m_timer;
+    std::chrono::milliseconds m_tick;
+
+    std::vector<std::vector<Callback>> m_slots;     // wheel context only
+    size_t m_cursor{ 0 };
+    size_t m_next_slot{ 0 };
+
+    std::mutex m_mtx_added;
+    std::vector<Callback> m_added;                  // waiting for the next tick
+
+    std::atomic<size_t> m_size{ 0 };
+    std::atomic<bool> m_running{ false };
+};
@@ -1,5 +1,6 @@
 #include <boost/asio.hpp>
 #include <iostream>
+#include <cstdlib>
 #include "Server.h"
 
 namespace io = boost::asio;
@@ -17,17 +18,46 @@ void thread_update_signals(Server& server, size_t signal_count, bool& isStop, st
 #endif
 
 
-int main() 
+// usage: Server [port] [threads] [reuseport] [pin] [metrics_port]
+//  threads      - number of io threads, 0: one per core (default 1)
+//  reuseport    - 1: one SO_REUSEPORT acceptor per io thread (Linux), 0: round-robin (default)
+//  pin          - 1: pin io threads to cores
+//  metrics_port - serve GET /metrics on 127.0.0.1:metrics_port (default off)
+int main(int argc, char* argv[]) 
 {
     try
     {
-        io::io_context io;
+        uint16_t port = 5000;
+        int threads = 1;
+        bool reuse_port = false;
+        bool pin = false;
+        int metrics_port = -1;
 
-        Server server(io, 5000);
+        if (argc >= 2)
+            port = static_cast<uint16_t>(std::atoi(argv[1]));
+
+        if (argc >= 3)
+            threads = std::atoi(argv[2]);
+
+        if (argc >= 4)
+            reuse_port = std::atoi(argv[3]) != 0;
+
+        if (argc >= 5)
+            pin = std::atoi(argv[4]) != 0;
+
+        if (argc >= 6)
+            metrics_port = std::atoi(argv[5]);
+
+        IoPool pool(threads > 0 ? threads : 0, pin);
+
+        Server server(pool, port, reuse_port ? EAcceptMode::reuse_port : EAcceptMode::round_robin);
 
         server.EnableDataEmulation(true);
         server.EnableShowLogMsg(true);
 
+        if (metrics_port >= 0)
+            server.EnableMetrics(static_cast<uint16_t>(metrics_port));
+
         VecSignal signals = 
         {   Signal{ 1, ESignalType::discret } ,
             Signal{ 2, ESignalType::discret },
@@ -50,7 +80,16 @@ int main()
 #endif
 
 
-        io.run();
+        if (server.IsShowLogMsg())
+        {
+            std::cout << "Listening on port " << server.GetPort() << ", io threads: " << pool.Size() << "\n";
+
+            if (server.GetMetricsPort())
+                std::cout << "Metrics on http://127.0.0.1:" << server.GetMetricsPort() << "/metrics\n";
+        }
+
+        pool.Run();
+        pool.Join();
 
 
 #ifdef TEST_SERVER_API
@@ -0,0 +1,187 @@
+// client_test.cpp
+
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include <thread>
+#include <functional>
+#include "Client.h"
+#include "Codec.h"
+
+
+namespace
+{
+    using tcp = boost::asio::ip::tcp;
+
+    // a client against the server end of its connection, driven by hand
+    struct ClientFixture
+    {
+        boost::asio::io_context io;             // server side, blocking calls from the test thread
+        tcp::acceptor acceptor{ io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0) };
+
+        boost::asio::io_context io_client;
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work{ boost::asio::make_work_guard(io_client) };
+        Client client{ io_client, "127.0.0.1", acceptor.local_endpoint().port(), ESignalType::analog };
+        std::thread th;
+
+        ClientFixture()
+        {
+            acceptor.non_blocking(true);
+
+            client.EnableShowLogMsg(false);
+            th = std::thread([this]() { io_client.run(); });
+            client.Start();
+        }
+
+        ~ClientFixture()
+        {
+            client.Stop();
+            io_client.stop();
+            th.join();
+        }
+
+        // accept the client and read its subscribe, false on timeout (the client reconnects after 2 s)
+        bool accept(tcp::socket& peer, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+
+            boost::system::error_code ec;
+            while (acceptor.accept(peer, ec), ec == boost::asio::error::would_block)
+            {
+                if (std::chrono::steady_clock::now() > deadline)
+                {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            if (ec)
+            {
+                return false;
+            }
+
+            peer.non_blocking(false);
+            peer.set_option(tcp::no_delay(true));
+
+            SSignalProtocolHeader hdr;
+            boost::asio::read(peer, boost::asio::buffer(&hdr, sizeof(hdr)));
+
+            std::vector<uint8_t> body(net_to_host_u32(hdr.len));
+            boost::asio::read(peer, boost::asio::buffer(body));
+
+            return hdr.data_type == 0x01;
+        }
+    };
+
+    std::vector<uint8_t> make_data_frame(uint8_t msg_num, const VecSignal& signals)
+    {
+        SharedPayload payload = make_shared_payload(signals, (uint8_t)ESignalType::analog, WireFormat());
+
+        SSignalProtocolHeader hdr = make_header(0x02, msg_num, static_cast<uint32_t>(payload->size()));
+
+        // sized once, both parts copied in
+        std::vector<uint8_t> frame(sizeof(hdr) + payload->size());
+        std::memcpy(frame.data(), &hdr, sizeof(hdr));
+        std::memcpy(frame.data() + sizeof(hdr), payload->data(), payload->size());
+        return frame;
+    }
+
+    VecSignal make_analog_signals(uint32_t first, uint32_t count, double value)
+    {
+        VecSignal signals;
+        for (uint32_t id = first; id < first + count; id++)
+        {
+            signals.emplace_back(id, ESignalType::analog, value);
+        }
+        return signals;
+    }
+
+    bool wait_for(const std::function<bool()>& pred)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (!pred() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return pred();
+    }
+}
+
+TEST(ClientTest, ReassemblesSplitFrames)
+{
+    ClientFixture f;
+
+    tcp::socket peer(f.io);
+    ASSERT_TRUE(f.accept(peer));
+
+    // two frames, one byte per write
+    std::vector<uint8_t> bytes = make_data_frame(0, make_analog_signals(1, 3, 1.0));
+    std::vector<uint8_t> second = make_data_frame(1, { { 2, ESignalType::analog, 2.0 } });
+    bytes.insert(bytes.end(), second.begin(), second.end());
+
+    for (uint8_t b : bytes)
+    {
+        boost::asio::write(peer, boost::asio::buffer(&b, 1));
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    ASSERT_TRUE(wait_for([&]() { return f.client.GetPacketCount() == 2; }));
+
+    MapSignal m = f.client.GeSignals();
+    ASSERT_EQ(3, m.size());
+    ASSERT_EQ(1.0, m[1].value);
+    ASSERT_EQ(2.0, m[2].value);
+
+    // a frame larger than the receive buffer, then a small one, split across reads mid-body and
+    // mid-header: the buffer grows for the large frame and every frame is taken whole
+    const uint32_t NUM_LARGE = 20000;
+    bytes = make_data_frame(2, make_analog_signals(1, NUM_LARGE, 3.0));
+    second = make_data_frame(3, { { 1, ESignalType::analog, 4.0 } });
+    bytes.insert(bytes.end(), second.begin(), second.end());
+
+    const size_t cuts[] = { 5, bytes.size() / 3, bytes.size() - second.size() + 3, bytes.size() };
+    size_t pos = 0;
+    for (size_t cut : cuts)
+    {
+        boost::asio::write(peer, boost::asio::buffer(bytes.data() + pos, cut - pos));
+        pos = cut;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    ASSERT_TRUE(wait_for([&]() { return f.client.GetPacketCount() == 4; }));
+
+    m = f.client.GeSignals();
+    ASSERT_EQ(NUM_LARGE, m.size());
+    ASSERT_EQ(4.0, m[1].value);
+    ASSERT_EQ(3.0, m[NUM_LARGE].value);
+}
+
+TEST(ClientTest, OversizedFrameReconnects)
+{
+    ClientFixture f;
+
+    tcp::socket peer(f.io);
+    ASSERT_TRUE(f.accept(peer));
+
+    std::vector<uint8_t> frame = make_data_frame(0, make_analog_signals(1, 3, 1.0));
+    boost::asio::write(peer, boost::asio::buffer(frame));
+    ASSERT_TRUE(wait_for([&]() { return f.client.GetPacketCount() == 1; }));
+
+    // a header announcing more than the receive cap: the client drops the connection without waiting for the body
+    SSignalProtocolHeader hdr = make_header(0x02, 1, 10 * 1024 * 1024 + 1);
+    boost::asio::write(peer, boost::asio::buffer(&hdr, sizeof(hdr)));
+
+    std::vector<uint8_t> buf(1);
+    boost::system::error_code ec;
+    boost::asio::read(peer, boost::asio::buffer(buf), ec);
+    ASSERT_TRUE(ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset);
+    ASSERT_EQ(1, f.client.GetPacketCount());
+
+    // ... and subscribes again on a new one, starting over from an empty state
+    tcp::socket again(f.io);
+    ASSERT_TRUE(f.accept(again, std::chrono::seconds(10)));
+
+    frame = make_data_frame(0, { { 7, ESignalType::analog, 7.0 } });
+    boost::asio::write(again, boost::asio::buffer(frame));
+
+    ASSERT_TRUE(wait_for([&]() { return f.client.GeSignals().size() == 1 && f.client.GeSignals()[7].value == 7.0; }));
+    ASSERT_EQ(1, f.client.GetPacketCount());
+}
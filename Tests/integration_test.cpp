@@ -5,6 +5,9 @@
 #include "Client.h"
 #include "Utils.h"
 #include <assert.h>
+#include <algorithm>
+#include <functional>
+#include <sstream>
 
 
 class TestClient : public Client 
@@ -108,6 +111,10 @@ private:
     // first full packet check
     std::promise<bool> m_snapshot_received_promise;
 
+    // received signals (own decoding, see process_body)
+    std::mutex m_mtx_signal;
+    MapSignal m_map_signal;
+
     // etalon data
     MapSignal m_map_init_etalon;
     MapSignal m_map_final_etalon;
@@ -198,7 +205,7 @@ TEST(IntegrationTest, DataLogicTest)
             {4, ESignalType::analog, 12.5},
         };
 
-        server.SetSignals(test_signals);
+        server.SetSignalsAndWait(test_signals);
         server.EnableShowLogMsg(false);
 
         server.Start();
@@ -316,3 +323,965 @@ TEST(IntegrationTest, DataLogicTest)
 
 }
 
+
+static void run_id_filtered_subscription(const WireFormat& format)
+{
+    const uint32_t NUM_SIGNALS = 31000;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    // one single id, one expanded range, one range matched by comparison,
+    // narrow ranges beyond the per-subscriber expansion budget (the last ones matched by comparison)
+    VecIdRange ranges = { { 5, 5 }, { 100, 199 }, { 5000, 9999 } };
+    for (uint32_t k = 0; k < 5; k++)
+    {
+        ranges.push_back({ 10001 + k * 4001, 10001 + k * 4001 + 3999 });
+    }
+
+    boost::asio::io_context io_client;
+    auto work_guard_client = boost::asio::make_work_guard(io_client);
+
+    Client client(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    client.EnableShowLogMsg(false);
+    client.SetIdFilter(ranges);
+    client.SetWireFormat(format);
+
+    std::thread io_thread_client([&io_client]() { io_client.run(); });
+    client.Start();
+
+    const size_t expected = 1 + 100 + 5000 + 5 * 4000;
+    auto wait_for = [&](const std::function<bool(const MapSignal&)>& pred)
+        {
+            auto start = std::chrono::steady_clock::now();
+            while (std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            {
+                if (pred(client.GeSignals()))
+                {
+                    return true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return false;
+        };
+
+    // snapshot
+    ASSERT_TRUE(wait_for([&](const MapSignal& m) { return m.size() == expected; }));
+
+    // updates of all ids, only the subscribed ones arrive
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        server.PushSignal({ id, ESignalType::analog, 1.0, std::chrono::steady_clock::now() });
+    }
+
+    ASSERT_TRUE(wait_for([&](const MapSignal& m) 
+        {
+            return m.size() == expected && std::all_of(m.begin(), m.end(), [](const MapSignal::value_type& e) { return e.second.value == 1.0; });
+        }));
+
+    for (const auto& e : client.GeSignals())
+    {
+        ASSERT_TRUE(id_in_ranges(ranges, e.first)) << "unexpected id " << e.first;
+    }
+
+    // the client reconnects on a cancelled read, stop its context
+    client.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, IdFilteredSubscription)
+{
+    run_id_filtered_subscription(WireFormat());
+}
+
+TEST(IntegrationTest, IdFilteredSubscriptionV2)
+{
+    WireFormat format;
+    format.version = 2;
+
+    run_id_filtered_subscription(format);
+}
+
+TEST(IntegrationTest, EndToEndLatency)
+{
+    const uint32_t NUM_SIGNALS = 100;
+    const int NUM_ROUNDS = 50;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, (id % 2) ? ESignalType::analog : ESignalType::discret, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    boost::asio::io_context io_client;
+    Client client(io_client, "127.0.0.1", server.GetPort(), ESignalType::discret | ESignalType::analog);
+    client.EnableShowLogMsg(false);
+
+    WireFormat format;
+    format.version = 2;
+    format.options = WIRE_OPT_TIMESTAMPS;
+    client.SetWireFormat(format);
+
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+    client.Start();
+
+    auto start = std::chrono::steady_clock::now();
+    while (client.GeSignals().size() != NUM_SIGNALS && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // the snapshot carries no source times (SetSignals)
+    ASSERT_EQ(0, client.GetLatency(ESignalType::analog).Count());
+
+    for (int round = 1; round <= NUM_ROUNDS; round++)
+    {
+        for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+        {
+            server.PushSignal({ id, (id % 2) ? ESignalType::analog : ESignalType::discret, double(round % 2), std::chrono::steady_clock::now() });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    const uint64_t expected = NUM_SIGNALS / 2 * NUM_ROUNDS;
+    start = std::chrono::steady_clock::now();
+    while ((client.GetLatency(ESignalType::analog).Count() < expected || client.GetLatency(ESignalType::discret).Count() < expected) &&
+        std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    for (ESignalType type : { ESignalType::discret, ESignalType::analog })
+    {
+        const Histogram& h = client.GetLatency(type);
+        ASSERT_EQ(expected, h.Count());
+
+        std::cout << (type == ESignalType::analog ? "analog" : "discrete") << " latency, us: p50 " << h.Percentile(50)
+            << ", p99 " << h.Percentile(99) << ", p99.9 " << h.Percentile(99.9) << ", max " << h.Max() << "\n";
+
+        ASSERT_LT(h.Percentile(50), 1000 * 1000);
+    }
+
+    client.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, SnapshotIsCopyOnWrite)
+{
+    const uint32_t NUM_SIGNALS = 50;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    boost::asio::io_context io_client;
+    Client client(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    client.EnableShowLogMsg(false);
+
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+    client.Start();
+
+    auto start = std::chrono::steady_clock::now();
+    while (client.GetSnapshot()->signals.size() != NUM_SIGNALS && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    SharedSignalTable before = client.GetSnapshot();
+    ASSERT_EQ(NUM_SIGNALS, before->signals.size());
+
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        server.PushSignal({ id, ESignalType::analog, 1.0, std::chrono::steady_clock::now() });
+    }
+
+    start = std::chrono::steady_clock::now();
+    while (client.GetSnapshot()->Find(NUM_SIGNALS)->value != 1.0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // the held snapshot did not change, the current one has every update
+    SharedSignalTable after = client.GetSnapshot();
+    ASSERT_NE(before.get(), after.get());
+
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        ASSERT_EQ(0.0, before->Find(id)->value);
+        ASSERT_EQ(1.0, after->Find(id)->value);
+    }
+
+    MapSignal map = client.GeSignals();
+    ASSERT_EQ(NUM_SIGNALS, map.size());
+    ASSERT_EQ(1.0, map[1].value);
+
+    client.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, SchemaChangeWithoutReconnect)
+{
+    const uint32_t NUM_SIGNALS = 10;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    // an analog-only and a full subscriber
+    boost::asio::io_context io_client;
+    Client analog(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    Client all(io_client, "127.0.0.1", server.GetPort(), ESignalType::discret | ESignalType::analog);
+    analog.EnableShowLogMsg(false);
+    all.EnableShowLogMsg(false);
+
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+    analog.Start();
+    all.Start();
+
+    auto wait_for = [](const std::function<bool()>& pred)
+        {
+            auto start = std::chrono::steady_clock::now();
+            while (!pred() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return pred();
+        };
+
+    ASSERT_TRUE(wait_for([&]() { return analog.GeSignals().size() == NUM_SIGNALS && all.GeSignals().size() == NUM_SIGNALS; }));
+
+    ASSERT_TRUE(wait_for([&]() { return server.GetSubscriberCount() == 2; }));
+    server.PushSignal({ 1, ESignalType::analog, 5.0, std::chrono::steady_clock::now() });
+    ASSERT_TRUE(wait_for([&]() { return all.GeSignals()[1].value == 5.0; }));
+
+    server.AddSignals({ { 100, ESignalType::discret, 1.0 }, { 101, ESignalType::analog, 2.0 } });
+    server.RemoveSignals({ 2 });
+    server.AddSignals({ { 3, ESignalType::discret, 1.0 } });     // retype
+
+    ASSERT_TRUE(wait_for([&]() { return all.GeSignals().size() == NUM_SIGNALS + 1 && all.GeSignals()[3].type == ESignalType::discret && analog.GeSignals().size() == NUM_SIGNALS - 1; }));
+
+    MapSignal m = all.GeSignals();
+    ASSERT_EQ(0, m.count(2));
+    ASSERT_EQ(ESignalType::discret, m[3].type);
+    ASSERT_EQ(ESignalType::discret, m[100].type);
+    ASSERT_EQ(2.0, m[101].value);
+    ASSERT_EQ(5.0, m[1].value);     // kept signals keep their value
+
+    // the retyped signal left the analog mask
+    m = analog.GeSignals();
+    ASSERT_EQ(0, m.count(2));
+    ASSERT_EQ(0, m.count(3));
+    ASSERT_EQ(0, m.count(100));
+    ASSERT_EQ(1, m.count(101));
+
+    // new signals are live
+    server.PushSignal({ 101, ESignalType::analog, 7.0, std::chrono::steady_clock::now() });
+    ASSERT_TRUE(wait_for([&]() { return analog.GeSignals()[101].value == 7.0 && all.GeSignals()[101].value == 7.0; }));
+
+    // a given value replaces the live one
+    server.AddSignals({ { 101, ESignalType::analog, 8.0 } });
+    ASSERT_TRUE(wait_for([&]() { return analog.GeSignals()[101].value == 8.0 && all.GeSignals()[101].value == 8.0; }));
+
+    // a full replacement through SetSignals, the last of a duplicate id wins
+    server.SetSignals({ { 1, ESignalType::analog, 0.0 }, { 200, ESignalType::analog, 3.0 }, { 200, ESignalType::analog, 4.0 } });
+    ASSERT_TRUE(wait_for([&]() { return all.GeSignals().size() == 2 && analog.GeSignals().size() == 2 && all.GeSignals()[1].value == 0.0; }));
+    ASSERT_EQ(4.0, all.GeSignals()[200].value);
+    ASSERT_EQ(4.0, analog.GeSignals()[200].value);
+
+    // nobody reconnected
+    ASSERT_EQ(2, server.GetCounters().sessions_accepted.Value());
+    ASSERT_EQ(0, server.GetCounters().sessions_closed.Value());
+
+    analog.Stop();
+    all.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, SchemaChangesAppliedInCallOrder)
+{
+    boost::asio::io_context io;
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+    server.Start();
+
+    // queued without waiting, then one that waits: it returns after the earlier ones too
+    server.SetSignals({ { 1, ESignalType::analog, 1.0 }, { 2, ESignalType::analog, 2.0 } });
+    server.AddSignals({ { 3, ESignalType::discret, 1.0 } });
+    server.RemoveSignals({ 1 });
+    server.AddSignalsAndWait({ { 1, ESignalType::discret, 0.0 }, { 4, ESignalType::analog, 4.0 } });
+
+    Signal s;
+    ASSERT_EQ(4, server.GetSnapshot((uint8_t)(ESignalType::discret | ESignalType::analog)).size());
+    ASSERT_TRUE(server.GetSignal(1, s));
+    ASSERT_EQ(ESignalType::discret, s.type);
+    ASSERT_TRUE(server.GetSignal(3, s));
+
+    // the new ids take updates right away
+    ASSERT_TRUE(server.PushSignal({ 4, ESignalType::analog, 5.0, std::chrono::steady_clock::now() }));
+
+    server.RemoveSignalsAndWait({ 2, 3 });
+    ASSERT_FALSE(server.GetSignal(2, s));
+    ASSERT_FALSE(server.PushSignal({ 3, ESignalType::discret, 0.0, std::chrono::steady_clock::now() }));
+
+    server.Stop();
+}
+
+TEST(IntegrationTest, SharedSnapshotFrames)
+{
+    const uint32_t NUM_SIGNALS = 20;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    boost::asio::io_context io_client;
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+
+    std::vector<std::unique_ptr<Client>> clients;
+    auto connect = [&]()
+        {
+            clients.emplace_back(std::make_unique<Client>(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog));
+            clients.back()->EnableShowLogMsg(false);
+            clients.back()->Start();
+
+            auto start = std::chrono::steady_clock::now();
+            while (clients.back()->GeSignals().size() != NUM_SIGNALS && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return clients.back()->GeSignals();
+        };
+
+    const ServerCounters& counters = server.GetCounters();
+
+    // no update in between: one encoding for all
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ(NUM_SIGNALS, connect().size());
+    }
+    ASSERT_EQ(1, counters.snapshots_built.Value());
+    ASSERT_EQ(2, counters.snapshots_shared.Value());
+
+    auto wait_for = [](const std::function<bool()>& pred)
+        {
+            auto start = std::chrono::steady_clock::now();
+            while (!pred() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return pred();
+        };
+
+    // updates flowing between the subscribers: the cached frames are still shared, each new
+    // subscriber receives the updates since from the replay ring
+    for (int i = 1; i <= 5; i++)
+    {
+        server.PushSignal({ 5, ESignalType::analog, (double)i, std::chrono::steady_clock::now() });
+        server.PushSignal({ 6, ESignalType::analog, (double)-i, std::chrono::steady_clock::now() });
+        ASSERT_TRUE(wait_for([&]() { return clients[0]->GeSignals()[5].value == i; }));
+
+        connect();
+        ASSERT_TRUE(wait_for([&]() { return clients.back()->GeSignals()[5].value == i && clients.back()->GeSignals()[6].value == -i; }));
+        ASSERT_EQ(NUM_SIGNALS, clients.back()->GeSignals().size());
+    }
+    ASSERT_EQ(1, counters.snapshots_built.Value());
+    ASSERT_EQ(7, counters.snapshots_shared.Value());
+    ASSERT_EQ(0, counters.resumes.Value());
+
+    // more updates since than signals: a new state is cheaper than the catch-up
+    for (uint32_t i = 0; i < NUM_SIGNALS; i++)
+    {
+        server.PushSignal({ 7, ESignalType::analog, 100.0 + i, std::chrono::steady_clock::now() });
+    }
+    ASSERT_TRUE(wait_for([&]() { return clients[0]->GeSignals()[7].value == 100.0 + NUM_SIGNALS - 1; }));
+
+    MapSignal m = connect();
+    ASSERT_TRUE(wait_for([&]() { return clients.back()->GeSignals()[7].value == 100.0 + NUM_SIGNALS - 1; }));
+    ASSERT_EQ(5.0, m[5].value);
+    ASSERT_EQ(2, counters.snapshots_built.Value());
+
+    // a signal set change is never caught up from the ring
+    server.AddSignalsAndWait({ { 1, ESignalType::analog, 9.0 } });
+    m = connect();
+    ASSERT_EQ(9.0, m[1].value);
+    ASSERT_EQ(3, counters.snapshots_built.Value());
+
+    for (auto& c : clients)
+    {
+        c->Stop();
+    }
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, ChunkedSnapshot)
+{
+    const uint32_t NUM_SIGNALS = 1000;
+    const size_t CHUNK = 64;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+    server.SetSnapshotChunk(CHUNK);
+
+    // the snapshot is several times the queue limit: it is streamed, not queued
+    SlowConsumerPolicy policy;
+    policy.max_queue_bytes = 4 * 1024;
+    server.SetSlowConsumerPolicy(policy);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    boost::asio::io_context io_client;
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+
+    auto wait_for = [](const std::function<bool()>& pred)
+        {
+            auto start = std::chrono::steady_clock::now();
+            while (!pred() && std::chrono::steady_clock::now() - start < std::chrono::seconds(10))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return pred();
+        };
+
+    Client first(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    first.EnableShowLogMsg(false);
+    first.Start();
+
+    // an id-filtered subscriber encodes its own chunks as they are written
+    Client filtered(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    filtered.EnableShowLogMsg(false);
+    filtered.SetIdFilter({ { 101, 900 } });
+    filtered.Start();
+
+    ASSERT_TRUE(wait_for([&]() { return first.GeSignals().size() == NUM_SIGNALS && filtered.GeSignals().size() == 800; }));
+    ASSERT_EQ((NUM_SIGNALS + CHUNK - 1) / CHUNK, first.GetPacketCount());
+    ASSERT_EQ((800 + CHUNK - 1) / CHUNK, filtered.GetPacketCount());
+    ASSERT_EQ(0, server.GetCounters().slow_consumer_events.Value());
+
+    // updates keep flowing while a v2 client streams its snapshot: it must end with the newest values
+    std::atomic<bool> stop{ false };
+    std::thread writer([&]()
+        {
+            for (int round = 1; !stop; round++)
+            {
+                for (uint32_t id = 1; id <= NUM_SIGNALS; id += 7)
+                {
+                    server.PushSignal({ id, ESignalType::analog, double(round), std::chrono::steady_clock::now() });
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+
+    WireFormat format;
+    format.version = 2;
+
+    Client second(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    second.EnableShowLogMsg(false);
+    second.SetWireFormat(format);
+    second.Start();
+
+    ASSERT_TRUE(wait_for([&]() { return second.GeSignals().size() == NUM_SIGNALS; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    stop = true;
+    writer.join();
+
+    VecSignal expected = server.GetSnapshot(static_cast<uint8_t>(ESignalType::analog));
+    ASSERT_TRUE(wait_for([&]()
+        {
+            MapSignal received = second.GeSignals();
+            return std::all_of(expected.begin(), expected.end(), [&](const Signal& s) { return received[s.id].value == s.value; });
+        }));
+
+    first.Stop();
+    filtered.Stop();
+    second.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+static std::string http_get(uint16_t port, const std::string& path)
+{
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::socket socket(io);
+    socket.connect({ boost::asio::ip::address_v4::loopback(), port });
+
+    std::string request = "GET " + path + " HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    std::string response;
+    boost::system::error_code ec;
+    boost::asio::read(socket, boost::asio::dynamic_buffer(response), ec);
+
+    return response;
+}
+
+static uint64_t metric_value(const std::string& text, const std::string& name)
+{
+    size_t pos = text.find("\n" + name + " ");
+    if (pos == std::string::npos)
+    {
+        return UINT64_MAX;
+    }
+    return std::stoull(text.substr(pos + name.size() + 2));
+}
+
+TEST(IntegrationTest, ResumeAfterReconnect)
+{
+    const uint32_t NUM_SIGNALS = 100;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+    server.SetReplayCapacity(50);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    boost::asio::io_context io_client;
+    Client client(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    client.EnableShowLogMsg(false);
+    client.EnableResume(true);
+
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+    client.Start();
+
+    auto wait_for = [](const std::function<bool()>& pred)
+        {
+            auto start = std::chrono::steady_clock::now();
+            while (!pred() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return pred();
+        };
+
+    // disconnect / reconnect on the client io thread, so no frame is in flight meanwhile
+    auto on_client = [&](const std::function<void()>& fn)
+        {
+            std::promise<void> done;
+            boost::asio::post(io_client, [&]() { fn(); done.set_value(); });
+            done.get_future().wait();
+        };
+
+    auto push = [&](uint32_t id, double value)
+        {
+            server.PushSignal({ id, ESignalType::analog, value, std::chrono::steady_clock::now() });
+        };
+
+    ASSERT_TRUE(wait_for([&] { return client.GeSignals().size() == NUM_SIGNALS && client.GetLastSequence() != 0; }));
+
+    const ServerCounters& counters = server.GetCounters();
+    const uint64_t built = counters.snapshots_built.Value();
+
+    // short disconnect: only the missed updates are sent, the held signals stay
+    on_client([&] { client.Stop(); });
+    for (uint32_t id = 1; id <= 10; id++)
+    {
+        push(id, 7.0);
+    }
+    on_client([&] { client.Start(); });
+
+    ASSERT_TRUE(wait_for([&] { return client.GeSignals()[10].value == 7.0 && client.GetLastSequence() == server.GetSequence(); }));
+    MapSignal m = client.GeSignals();
+    ASSERT_EQ(NUM_SIGNALS, m.size());
+    ASSERT_EQ(7.0, m[10].value);
+    ASSERT_EQ(1, counters.resumes.Value());
+    ASSERT_EQ(0, counters.resume_misses.Value());
+    ASSERT_EQ(built, counters.snapshots_built.Value());
+
+    // more missed than the ring holds: the whole state again
+    on_client([&] { client.Stop(); });
+    for (int round = 0; round < 3; round++)
+    {
+        for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+        {
+            push(id, 10.0 + round);
+        }
+    }
+    on_client([&] { client.Start(); });
+
+    ASSERT_TRUE(wait_for([&] { return client.GeSignals()[NUM_SIGNALS].value == 12.0 && client.GetLastSequence() == server.GetSequence(); }));
+    ASSERT_EQ(NUM_SIGNALS, client.GeSignals().size());
+    ASSERT_EQ(1, counters.resume_misses.Value());
+
+    // a signal set change is never replayed: the state starts with a reset, the removed signal is gone
+    on_client([&] { client.Stop(); });
+    server.RemoveSignalsAndWait({ NUM_SIGNALS });
+    on_client([&] { client.Start(); });
+
+    ASSERT_TRUE(wait_for([&] { return client.GeSignals().size() == NUM_SIGNALS - 1; }));
+    ASSERT_EQ(2, counters.resume_misses.Value());
+    ASSERT_EQ(1, counters.resumes.Value());
+
+    client.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, ReconcileAfterReconnect)
+{
+    const uint32_t NUM_SIGNALS = 5000;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+    server.SetReplayCapacity(0);        // too long away for any replay
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, id * 0.5);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    boost::asio::io_context io_client;
+    Client client(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    client.EnableShowLogMsg(false);
+    client.EnableResume(true);
+    client.EnableReconcile(true);
+
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+    client.Start();
+
+    auto wait_for = [](const std::function<bool()>& pred)
+        {
+            auto start = std::chrono::steady_clock::now();
+            while (!pred() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return pred();
+        };
+
+    auto on_client = [&](const std::function<void()>& fn)
+        {
+            std::promise<void> done;
+            boost::asio::post(io_client, [&]() { fn(); done.set_value(); });
+            done.get_future().wait();
+        };
+
+    ASSERT_TRUE(wait_for([&] { return client.GeSignals().size() == NUM_SIGNALS && client.GetLastSequence() != 0; }));
+
+    // away: a few values change, one signal goes, one comes
+    on_client([&] { client.Stop(); });
+
+    for (uint32_t id : { 10, 2000, 4000 })
+    {
+        server.PushSignal({ id, ESignalType::analog, -1.0, std::chrono::steady_clock::now() });
+    }
+    server.RemoveSignalsAndWait({ 3000 });
+    server.AddSignalsAndWait({ { NUM_SIGNALS + 1, ESignalType::analog, 9.0 } });
+
+    const uint64_t bytes_sent = server.GetCounters().bytes_sent.Value();
+
+    on_client([&] { client.Start(); });
+
+    auto same_as_server = [&]()
+        {
+            MapSignal held = client.GeSignals();
+            VecSignal state = server.GetSnapshot((uint8_t)ESignalType::analog);
+            if (held.size() != state.size())
+            {
+                return false;
+            }
+            for (const auto& s : state)
+            {
+                auto it = held.find(s.id);
+                if (it == held.end() || it->second.value != s.value)
+                {
+                    return false;
+                }
+            }
+            return client.GetLastSequence() == server.GetSequence();
+        };
+    ASSERT_TRUE(wait_for(same_as_server));
+
+    const ServerCounters& counters = server.GetCounters();
+    ASSERT_EQ(1, counters.resume_misses.Value());
+    ASSERT_EQ(1, counters.reconciles.Value());
+
+    // at most one bucket per change out of 128, far less than the whole state
+    ASSERT_EQ(128, digest_bucket_count(NUM_SIGNALS));
+    ASSERT_GE(counters.reconcile_buckets_resent.Value(), 1);
+    ASSERT_LE(counters.reconcile_buckets_resent.Value(), 5);
+    ASSERT_LT(counters.bytes_sent.Value() - bytes_sent, NUM_SIGNALS * SIGNAL_RECORD_SIZE / 8);
+
+    client.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, MetricsEndpoint)
+{
+    const uint32_t NUM_SIGNALS = 10;
+
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+    server.EnableMetrics(0);
+    server.EnableStats(true);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    ASSERT_NE(0, server.GetMetricsPort());
+
+    boost::asio::io_context io_client;
+    Client client(io_client, "127.0.0.1", server.GetPort(), ESignalType::analog);
+    client.EnableShowLogMsg(false);
+
+    std::thread io_thread_client([&io_client]() { auto work = boost::asio::make_work_guard(io_client); io_client.run(); });
+    client.Start();
+
+    auto start = std::chrono::steady_clock::now();
+    while (server.GetSubscriberCount() == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(1, server.GetSubscriberCount());
+
+    const uint64_t dropped = server.GetCounters().updates_dropped.Value();
+
+    server.PushSignal({ 2, ESignalType::analog, 1.0, std::chrono::steady_clock::now() });
+    server.PushSignal({ 999, ESignalType::analog, 1.0, std::chrono::steady_clock::now() });     // unknown id
+
+    start = std::chrono::steady_clock::now();
+    while (client.GeSignals()[2].value != 1.0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(1.0, client.GeSignals()[2].value);
+
+    std::string response = http_get(server.GetMetricsPort(), "/metrics");
+
+    ASSERT_EQ(0, response.compare(0, 15, "HTTP/1.0 200 OK"));
+    ASSERT_NE(std::string::npos, response.find("# TYPE signal_server_updates_ingested_total counter"));
+
+    const uint64_t ingested = metric_value(response, "signal_server_updates_ingested_total");
+    ASSERT_EQ(1, ingested);
+    ASSERT_EQ(dropped + 1, metric_value(response, "signal_server_updates_dropped_total"));
+    ASSERT_EQ(1, metric_value(response, "signal_server_sessions_accepted_total"));
+    ASSERT_EQ(1, metric_value(response, "signal_server_subscribers"));
+    ASSERT_GE(metric_value(response, "signal_server_frames_sent_total"), 2);
+    ASSERT_GT(metric_value(response, "signal_server_bytes_sent_total"), 0);
+    ASSERT_EQ(1, metric_value(response, "signal_server_batch_updates_total"));
+    ASSERT_NE(std::string::npos, response.find("signal_server_session_queue_bytes{session=\""));
+    ASSERT_NE(std::string::npos, response.find("# TYPE signal_server_batch_size summary"));
+
+    // every sample follows the TYPE line of its own family
+    std::istringstream lines(response.substr(response.find("\r\n\r\n") + 4));
+    std::string line;
+    std::string family;
+    while (std::getline(lines, line))
+    {
+        if (line.compare(0, 7, "# TYPE ") == 0)
+        {
+            family = line.substr(7, line.find(' ', 7) - 7);
+        }
+        else if (!line.empty() && line[0] != '#')
+        {
+            std::string name = line.substr(0, line.find_first_of("{ "));
+            if (name.size() > 6 && name.compare(name.size() - 6, 6, "_count") == 0 && name != family)
+            {
+                name.resize(name.size() - 6);
+            }
+            ASSERT_EQ(family, name) << line;
+        }
+    }
+
+    ASSERT_EQ(0, http_get(server.GetMetricsPort(), "/").compare(0, 22, "HTTP/1.0 404 Not Found"));
+
+    client.Stop();
+    io_client.stop();
+    server.Stop();
+
+    work_guard_server.reset();
+
+    io_thread_srv.join();
+    io_thread_client.join();
+}
+
+TEST(IntegrationTest, MetricsConnectionsClosedOnStop)
+{
+    boost::asio::io_context io;
+    auto work_guard_server = boost::asio::make_work_guard(io);
+
+    auto server = std::make_unique<Server>(io, 0);
+    server->EnableDataEmulation(false);
+    server->EnableShowLogMsg(false);
+    server->EnableMetrics(0);
+    server->SetSignalsAndWait({ { 1, ESignalType::analog, 0.0 } });
+    server->Start();
+
+    std::thread io_thread_srv([&io]() { io.run(); });
+
+    // a scraper that connects but has not sent its request yet
+    boost::asio::io_context io_scraper;
+    boost::asio::ip::tcp::socket socket(io_scraper);
+    socket.connect({ boost::asio::ip::address_v4::loopback(), server->GetMetricsPort() });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // the io_context outlives the server: the connection is closed, not answered later
+    server->Stop();
+    server.reset();
+
+    std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+    boost::system::error_code ec;
+    boost::asio::write(socket, boost::asio::buffer(request), ec);
+
+    std::string response;
+    boost::asio::read(socket, boost::asio::dynamic_buffer(response), ec);
+    ASSERT_TRUE(response.empty());
+
+    work_guard_server.reset();
+    io_thread_srv.join();
+}
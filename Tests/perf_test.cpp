@@ -4,6 +4,14 @@
 #include <boost/asio.hpp>
 #include <chrono>
 #include "Server.h"
+#include "Codec.h"
+#include "SignalStore.h"
+#include "MpscRing.h"
+#include <deque>
+#include <iterator>
+#include <random>
+#include <iomanip>
+#include <algorithm>
 
 TEST(Perf, ServerThroughput) 
 {
@@ -37,4 +45,476 @@ TEST(Perf, ServerThroughput)
 
     server.Stop();
     th.join();
-}
\ No newline at end of file
+}
+
+TEST(Perf, FanOutEncodeOnce)
+{
+    using namespace std::chrono;
+
+    const int NUM_SUBSCRIBERS = 2000;
+    const int BATCH_SIZE = 100;
+
+    VecSignal batch;
+    for (int i = 0; i < BATCH_SIZE; i++)
+    {
+        batch.emplace_back((uint32_t)i, (i % 2) ? ESignalType::analog : ESignalType::discret, double(i));
+    }
+
+    const uint8_t mask = (uint8_t)(ESignalType::discret | ESignalType::analog);
+
+    // per-session encoding: copy the batch, encode records, build header + frame for each subscriber
+    size_t bytes_legacy = 0;
+    auto t0 = high_resolution_clock::now();
+    for (int i = 0; i < NUM_SUBSCRIBERS; i++)
+    {
+        VecSignal copy = batch;
+
+        std::vector<uint8_t> payload;
+        encode_signals(copy, mask, payload);
+
+        SSignalProtocolHeader hdr = make_header(0x02, (uint8_t)i, (uint32_t)payload.size());
+        auto frame = std::make_shared<std::vector<uint8_t>>(sizeof(hdr) + payload.size());
+        std::memcpy(frame->data(), &hdr, sizeof(hdr));
+        std::memcpy(frame->data() + sizeof(hdr), payload.data(), payload.size());
+
+        bytes_legacy += frame->size();
+    }
+    auto t1 = high_resolution_clock::now();
+
+    // encode once: shared payload, only the header differs per subscriber
+    size_t bytes_shared = 0;
+    auto t2 = high_resolution_clock::now();
+    SharedPayload shared = make_shared_payload(batch, mask);
+    for (int i = 0; i < NUM_SUBSCRIBERS; i++)
+    {
+        SharedPayload ref = shared;
+        SSignalProtocolHeader hdr = make_header(0x02, (uint8_t)i, (uint32_t)ref->size());
+
+        bytes_shared += sizeof(hdr) + ref->size();
+    }
+    auto t3 = high_resolution_clock::now();
+
+    double ns_legacy = double(duration_cast<nanoseconds>(t1 - t0).count()) / NUM_SUBSCRIBERS;
+    double ns_shared = double(duration_cast<nanoseconds>(t3 - t2).count()) / NUM_SUBSCRIBERS;
+
+    std::cout << "\nFan-out " << BATCH_SIZE << " signals to " << NUM_SUBSCRIBERS << " subscribers: "
+        << "per-session encode " << ns_legacy << " ns/subscriber, "
+        << "encode once " << ns_shared << " ns/subscriber\n";
+
+    EXPECT_EQ(bytes_legacy, bytes_shared);
+    EXPECT_LT(ns_shared, ns_legacy);
+}
+
+
+// time for a client to receive `num_frames` small frames queued in a burst on one session
+static double measure_write_burst(size_t write_batch_bytes, int num_frames)
+{
+    using namespace std::chrono;
+    using tcp = boost::asio::ip::tcp;
+
+    boost::asio::io_context io;
+    Server server(io, 0);
+    server.EnableShowLogMsg(false);
+    server.EnableDataEmulation(false);
+    server.SetWriteBatchBytes(write_batch_bytes);
+
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    tcp::socket client_socket(io);
+    client_socket.connect(acceptor.local_endpoint());
+    tcp::socket server_socket = acceptor.accept();
+
+    auto session = std::make_shared<Session>(std::move(server_socket), server);
+
+    // no slow-consumer conflation, every frame is written
+    SlowConsumerPolicy policy;
+    policy.max_queue_bytes = SIZE_MAX;
+    policy.max_queue_frames = SIZE_MAX;
+    server.SetSlowConsumerPolicy(policy);
+
+    auto update = std::make_shared<const VecSignal>(VecSignal{ {1, ESignalType::analog, 1.0} });
+    SharedPayload payload = make_shared_payload(*update, (uint8_t)ESignalType::analog);
+    const size_t total = num_frames * (sizeof(SSignalProtocolHeader) + payload->size());
+
+    auto t0 = high_resolution_clock::now();
+
+    for (int i = 0; i < num_frames; i++)
+    {
+        session->DeliverPayload(payload, update);
+    }
+
+    std::thread th([&]() { io.run(); });
+
+    std::vector<uint8_t> buf(64 * 1024);
+    size_t received = 0;
+    while (received < total)
+    {
+        received += client_socket.read_some(boost::asio::buffer(buf));
+    }
+
+    auto t1 = high_resolution_clock::now();
+
+    session->ForceClose();
+    server.Stop();
+    io.stop();
+    th.join();
+
+    return double(duration_cast<microseconds>(t1 - t0).count()) / 1000.0;
+}
+
+TEST(Perf, GatherWriteBurst)
+{
+    const int N = 20000;
+
+    double ms_single = measure_write_burst(0, N);     // one frame per async_write
+    double ms_gather = measure_write_burst(256 * 1024, N);
+
+    std::cout << "\nWrite burst of " << N << " frames: one frame per write " << ms_single << " ms, "
+        << "gather write " << ms_gather << " ms\n";
+
+    EXPECT_LT(ms_gather, ms_single);
+}
+
+
+TEST(Perf, SignalStoreProducers)
+{
+    using namespace std::chrono;
+
+    const int NUM_SIGNALS = 1024;
+    const int UPDATES_PER_THREAD = 200000;
+
+    VecSignal signals;
+    for (int i = 0; i < NUM_SIGNALS; i++)
+    {
+        signals.emplace_back(i, ESignalType::analog, 0.0);
+    }
+
+    SignalStore store;
+    store.Reset(signals);
+
+    for (int num_threads : { 1, 2, 4 })
+    {
+        auto t0 = high_resolution_clock::now();
+
+        std::vector<std::thread> producers;
+        for (int t = 0; t < num_threads; t++)
+        {
+            producers.emplace_back([&, t]()
+                {
+                    Signal s(0, ESignalType::analog, 0.0, steady_clock::now());
+                    for (int i = 0; i < UPDATES_PER_THREAD; i++)
+                    {
+                        s.id = (i * num_threads + t) % NUM_SIGNALS;
+                        s.value = i;
+                        store.Update(s);
+                    }
+                });
+        }
+
+        for (auto& p : producers)
+        {
+            p.join();
+        }
+
+        auto t1 = high_resolution_clock::now();
+        double sec = duration_cast<duration<double>>(t1 - t0).count();
+
+        std::cout << "\nSignalStore: " << num_threads << " producer(s) " << (num_threads * UPDATES_PER_THREAD / sec / 1e6) << " M updates/s";
+    }
+    std::cout << "\n";
+}
+
+
+// updates/s from producers to one consumer: deque + condition_variable (notify per update)
+static double measure_deque_cv(int num_producers, int per_producer)
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Signal> queue;
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; p++)
+    {
+        producers.emplace_back([&]()
+            {
+                Signal s(1, ESignalType::analog);
+                for (int i = 0; i < per_producer; i++)
+                {
+                    {
+                        std::lock_guard<std::mutex> lk(mtx);
+                        queue.push_back(s);
+                    }
+                    cv.notify_one();
+                }
+            });
+    }
+
+    int received = 0;
+    VecSignal batch;
+    while (received < num_producers * per_producer)
+    {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            cv.wait(lk, [&] { return !queue.empty(); });
+
+            while (!queue.empty())
+            {
+                batch.push_back(queue.front());
+                queue.pop_front();
+            }
+        }
+        received += (int)batch.size();
+    }
+
+    for (auto& p : producers)
+    {
+        p.join();
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return num_producers * per_producer / std::chrono::duration<double>(t1 - t0).count();
+}
+
+// updates/s from producers to one consumer: MpscRing, notify only while the consumer is parked
+static double measure_ring(int num_producers, int per_producer)
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::atomic<bool> parked{ false };
+    MpscRing<Signal> ring(64 * 1024);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; p++)
+    {
+        producers.emplace_back([&]()
+            {
+                Signal s(1, ESignalType::analog);
+                for (int i = 0; i < per_producer; i++)
+                {
+                    while (!ring.TryPush(s))
+                    {
+                        std::this_thread::yield();
+                    }
+
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (parked.load(std::memory_order_relaxed))
+                    {
+                        std::lock_guard<std::mutex> lk(mtx);
+                        cv.notify_one();
+                    }
+                }
+            });
+    }
+
+    int received = 0;
+    VecSignal batch;
+    while (received < num_producers * per_producer)
+    {
+        batch.clear();
+        if (ring.Empty())
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            parked.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cv.wait(lk, [&] { return !ring.Empty(); });
+            parked.store(false, std::memory_order_relaxed);
+        }
+        received += (int)ring.TryPopBulk(std::back_inserter(batch), ring.Capacity());
+    }
+
+    for (auto& p : producers)
+    {
+        p.join();
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return num_producers * per_producer / std::chrono::duration<double>(t1 - t0).count();
+}
+
+TEST(Perf, IngestQueue)
+{
+    const int PER_PRODUCER = 200000;
+
+    for (int num_producers : { 1, 2, 4 })
+    {
+        double deque_cv = measure_deque_cv(num_producers, PER_PRODUCER);
+        double ring = measure_ring(num_producers, PER_PRODUCER);
+
+        std::cout << "\nIngest queue, " << num_producers << " producer(s): deque+cv " << deque_cv / 1e6 
+            << " M updates/s, mpsc ring " << ring / 1e6 << " M updates/s";
+    }
+    std::cout << "\n";
+}
+
+TEST(Perf, WireFormatSize)
+{
+    using namespace std::chrono;
+
+    const int NUM_SIGNALS = 1000;
+    const int NUM_ROUNDS = 200;
+
+    // half discrete 0 / 1, half slowly moving analogs, ids in random order
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> step(-0.5, 0.5);
+
+    VecSignal batch;
+    for (int i = 0; i < NUM_SIGNALS; i++)
+    {
+        if (i % 2)
+            batch.emplace_back((uint32_t)(1000 + i), ESignalType::analog, 100.0 + step(rng));
+        else
+            batch.emplace_back((uint32_t)(1000 + i), ESignalType::discret, double(rng() % 2));
+    }
+    std::shuffle(batch.begin(), batch.end(), rng);
+
+    const uint8_t mask = (uint8_t)(ESignalType::discret | ESignalType::analog);
+
+    struct Run
+    {
+        const char* name;
+        WireFormat format;
+    };
+
+    WireFormat v1, v2, v2_float;
+    v2.version = 2;
+    v2_float.version = 2;
+    v2_float.options = WIRE_OPT_FLOAT32;
+
+    size_t bytes_v1 = 0;
+    for (const Run& run : { Run{ "v1", v1 }, Run{ "v2", v2 }, Run{ "v2 float32", v2_float } })
+    {
+        std::vector<uint8_t> payload;
+
+        auto t0 = high_resolution_clock::now();
+        for (int r = 0; r < NUM_ROUNDS; r++)
+        {
+            if (run.format.version >= 2)
+                encode_signals_v2(batch, mask, run.format.options, payload);
+            else
+                encode_signals(batch, mask, payload);
+        }
+        auto t1 = high_resolution_clock::now();
+
+        size_t cnt = 0;
+        for (int r = 0; r < NUM_ROUNDS; r++)
+        {
+            if (run.format.version >= 2)
+            {
+                decode_signals_v2(payload.data(), payload.size(), [&](const Signal&) { cnt++; });
+            }
+            else
+            {
+                Signal s;
+                for (size_t pos = 0; pos + SIGNAL_RECORD_SIZE <= payload.size(); pos += SIGNAL_RECORD_SIZE)
+                {
+                    decode_signal(payload.data() + pos, s);
+                    cnt++;
+                }
+            }
+        }
+        auto t2 = high_resolution_clock::now();
+
+        ASSERT_EQ(size_t(NUM_SIGNALS) * NUM_ROUNDS, cnt);
+
+        double updates = double(NUM_SIGNALS) * NUM_ROUNDS;
+        std::cout << "\nWire format " << run.name << ": " << double(payload.size()) / NUM_SIGNALS << " bytes/update, "
+            << duration_cast<nanoseconds>(t1 - t0).count() / updates << " ns encode, "
+            << duration_cast<nanoseconds>(t2 - t1).count() / updates << " ns decode";
+
+        if (run.format.version == 1)
+            bytes_v1 = payload.size();
+        else
+            EXPECT_LT(payload.size(), bytes_v1);
+    }
+    std::cout << "\n";
+}
+
+TEST(Perf, PipelineStages)
+{
+    const uint32_t NUM_SIGNALS = 200;
+    const int NUM_ROUNDS = 100;
+
+    boost::asio::io_context io;
+    auto work = boost::asio::make_work_guard(io);
+
+    Server server(io, 0);
+    server.EnableShowLogMsg(false);
+    server.EnableDataEmulation(false);
+    server.EnableStats(true);
+
+    VecSignal signals;
+    for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+    {
+        signals.emplace_back(id, ESignalType::analog, 0.0);
+    }
+    server.SetSignalsAndWait(signals);
+    server.Start();
+
+    std::thread th([&]() { io.run(); });
+
+    // raw subscriber, drains the socket in the background
+    using tcp = boost::asio::ip::tcp;
+    tcp::socket client(io);
+    client.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.GetPort()));
+
+    SSignalProtocolHeader hdr = make_header(0x01, 0, 1);
+    std::vector<uint8_t> frame(sizeof(hdr) + 1);
+    std::memcpy(frame.data(), &hdr, sizeof(hdr));
+    frame[sizeof(hdr)] = (uint8_t)ESignalType::analog;
+    boost::asio::write(client, boost::asio::buffer(frame));
+
+    std::atomic<bool> reading{ true };
+    std::thread reader([&]()
+        {
+            std::vector<uint8_t> buf(64 * 1024);
+            boost::system::error_code ec;
+            while (reading && !ec)
+            {
+                client.read_some(boost::asio::buffer(buf), ec);
+            }
+        });
+
+    // let the session register
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (int round = 0; round < NUM_ROUNDS; round++)
+    {
+        for (uint32_t id = 1; id <= NUM_SIGNALS; id++)
+        {
+            server.PushSignal({ id, ESignalType::analog, double(round), std::chrono::steady_clock::now() });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::cout << "\nPipeline stage            count      p50      p99    p99.9      max\n";
+    for (size_t i = 0; i < (size_t)EStage::count; i++)
+    {
+        Histogram h;
+        server.GetStats().Collect((EStage)i, h);
+
+        std::cout << std::left << std::setw(20) << stage_name((EStage)i) << std::right
+            << std::setw(11) << h.Count() << std::setw(9) << h.Percentile(50) << std::setw(9) << h.Percentile(99)
+            << std::setw(9) << h.Percentile(99.9) << std::setw(9) << h.Max() << "\n";
+
+        EXPECT_GT(h.Count(), 0u) << stage_name((EStage)i);
+    }
+
+    Histogram ingest;
+    server.GetStats().Collect(EStage::ingest_wait, ingest);
+    EXPECT_EQ(NUM_SIGNALS * NUM_ROUNDS, ingest.Count());
+
+    reading = false;
+    server.Stop();
+    boost::system::error_code ec;
+    client.shutdown(tcp::socket::shutdown_both, ec);
+    client.close(ec);
+    reader.join();
+
+    work.reset();
+    th.join();
+}
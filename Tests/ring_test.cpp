@@ -0,0 +1,83 @@
+// ring_test.cpp
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <iterator>
+#include "MpscRing.h"
+
+
+TEST(MpscRingTest, FifoAndFull)
+{
+    MpscRing<int> ring(3);     // rounded up to 4
+    ASSERT_EQ(4, ring.Capacity());
+    ASSERT_TRUE(ring.Empty());
+
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(ring.TryPush(i));
+    }
+    ASSERT_FALSE(ring.TryPush(4));
+
+    std::vector<int> out;
+    ASSERT_EQ(2, ring.TryPopBulk(std::back_inserter(out), 2));
+    ASSERT_EQ((std::vector<int>{ 0, 1 }), out);
+
+    // wrap around
+    ASSERT_TRUE(ring.TryPush(4));
+    ASSERT_TRUE(ring.TryPush(5));
+    ASSERT_FALSE(ring.TryPush(6));
+
+    out.clear();
+    ASSERT_EQ(4, ring.TryPopBulk(std::back_inserter(out), 100));
+    ASSERT_EQ((std::vector<int>{ 2, 3, 4, 5 }), out);
+    ASSERT_TRUE(ring.Empty());
+}
+
+TEST(MpscRingTest, MultipleProducers)
+{
+    const int NUM_PRODUCERS = 4;
+    const int PER_PRODUCER = 50000;
+
+    MpscRing<int> ring(1024);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < NUM_PRODUCERS; p++)
+    {
+        producers.emplace_back([&ring, p]()
+            {
+                for (int i = 0; i < PER_PRODUCER; i++)
+                {
+                    while (!ring.TryPush(p * PER_PRODUCER + i))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+    }
+
+    // every item arrives once, in order per producer
+    std::vector<int> last(NUM_PRODUCERS, -1);
+    std::vector<int> batch;
+    int received = 0;
+
+    while (received < NUM_PRODUCERS * PER_PRODUCER)
+    {
+        batch.clear();
+        received += (int)ring.TryPopBulk(std::back_inserter(batch), 256);
+
+        for (int v : batch)
+        {
+            int p = v / PER_PRODUCER;
+            ASSERT_LT(last[p], v);
+            last[p] = v;
+        }
+    }
+
+    for (auto& p : producers)
+    {
+        p.join();
+    }
+
+    ASSERT_TRUE(ring.Empty());
+}
@@ -2,6 +2,8 @@
 
 #include "gtest/gtest.h"
 #include "Server.h"
+#include <iterator>
+#include <thread>
 
 
 class TestServer : public Server 
@@ -13,11 +15,35 @@ public:
 
     void FillState(const VecSignal& signals) 
     {
-        std::lock_guard<std::mutex> lk(m_mtx_state);
-        for (const auto& s : signals) 
+        m_state.Reset(signals);
+    }
+
+    // stop the dispatcher so that pushed updates stay pending
+    void StopDispatcher()
+    {
+        m_running = false;
+        m_cv_queue.notify_all();
+        m_dispatcher.join();
+    }
+
+    // take what the dispatcher would get (the dispatcher must be stopped)
+    VecSignal TakePendingUpdates()
+    {
+        std::lock_guard<std::mutex> lk(m_mtx_queue);
+
+        std::vector<QueuedSignal> queued;
+        m_queue.TryPopBulk(std::back_inserter(queued), m_queue.Capacity());
+
+        VecSignal out;
+        for (const auto& q : queued)
         {
-            m_state[s.id] = s;
+            out.push_back(q.signal);
         }
+        out.insert(out.end(), m_dirty.begin(), m_dirty.end());
+
+        m_dirty.clear();
+        m_dirty_pos.clear();
+        return out;
     }
 };
 
@@ -63,4 +89,156 @@ TEST(ServerTest, SnapshotFiltering)
     // wait 1 discret signal (ID 2)
     ASSERT_EQ(1, snapshot_analog.size());
     ASSERT_EQ(ESignalType::analog, snapshot_analog[0].type); 
-}
\ No newline at end of file
+}
+
+TEST(ServerTest, SequenceBasePerInstance)
+{
+    boost::asio::io_context io;
+
+    // started within the same second: the clients of one must not resume against the other
+    Server first(io, 0);
+    Server second(io, 0);
+
+    ASSERT_NE(0, first.GetSequence());
+    ASSERT_NE(first.GetSequence(), second.GetSequence());
+    ASSERT_EQ(0, first.GetSequence() & 0xFFFFFFFF);
+}
+
+TEST(ServerTest, ConflateIngestion)
+{
+    boost::asio::io_context io;
+    TestServer server(io);
+
+    server.EnableShowLogMsg(false);
+    server.EnableDataEmulation(false);
+    server.SetIngestMode(EIngestMode::conflate);
+
+    server.FillState({ {1, ESignalType::discret, 0.0}, {2, ESignalType::analog, 0.0} });
+    server.StopDispatcher();
+
+    auto ts = std::chrono::steady_clock::now();
+
+    for (int i = 1; i <= 10000; i++)
+    {
+        ASSERT_TRUE(server.PushSignal({ 2, ESignalType::analog, double(i), ts }));
+    }
+    ASSERT_TRUE(server.PushSignal({ 1, ESignalType::discret, 1.0, ts }));
+    ASSERT_TRUE(server.PushSignal({ 2, ESignalType::analog, -1.0, ts }));
+
+    // only the newest value of each signal, in order of first change
+    auto pending = server.TakePendingUpdates();
+    ASSERT_EQ(2, pending.size());
+    ASSERT_EQ(Signal(2, ESignalType::analog, -1.0), pending[0]);
+    ASSERT_EQ(Signal(1, ESignalType::discret, 1.0), pending[1]);
+
+    // an older update enqueued last (as by a writer that lost the race): the newer pending value stays
+    const VecSignal old_state = { {1, ESignalType::discret, 0.0, ts - std::chrono::seconds(10)}, {2, ESignalType::analog, 0.0, ts - std::chrono::seconds(10)} };
+
+    ASSERT_TRUE(server.PushSignal({ 2, ESignalType::analog, 2.0, ts + std::chrono::seconds(1) }));
+    server.FillState(old_state);
+    ASSERT_TRUE(server.PushSignal({ 2, ESignalType::analog, 1.0, ts }));
+
+    pending = server.TakePendingUpdates();
+    ASSERT_EQ(1, pending.size());
+    ASSERT_EQ(2.0, pending[0].value);
+
+    // queue mode keeps every update
+    server.SetIngestMode(EIngestMode::queue);
+    ASSERT_TRUE(server.PushSignal({ 1, ESignalType::discret, 0.0, ts }));
+    ASSERT_TRUE(server.PushSignal({ 1, ESignalType::discret, 1.0, ts }));
+    ASSERT_EQ(2, server.TakePendingUpdates().size());
+}
+
+
+TEST(ServerTest, PushSignalsBlock)
+{
+    boost::asio::io_context io;
+    TestServer server(io);
+
+    server.EnableShowLogMsg(false);
+    server.EnableDataEmulation(false);
+
+    auto ts = std::chrono::steady_clock::now();
+    server.FillState({ {1, ESignalType::discret, 0.0, ts}, {2, ESignalType::analog, 0.0, ts} });
+    server.StopDispatcher();
+
+    VecSignal block =
+    {
+        {2, ESignalType::analog, 1.0, ts},
+        {7, ESignalType::analog, 1.0, ts},                              // unknown id
+        {1, ESignalType::discret, 1.0, ts - std::chrono::seconds(1)},   // older than the state
+        {1, ESignalType::discret, 1.0, ts},
+        {2, ESignalType::analog, 2.0, ts},
+    };
+
+    auto accepted = server.PushSignals(block);
+    ASSERT_EQ((std::vector<bool>{ true, false, false, true, true }), accepted);
+
+    auto pending = server.TakePendingUpdates();
+    ASSERT_EQ((VecSignal{ block[0], block[3], block[4] }), pending);
+
+    Signal s;
+    ASSERT_TRUE(server.GetSignal(2, s));
+    ASSERT_EQ(block[4], s);
+
+    // conflate mode: newest value per id
+    server.SetIngestMode(EIngestMode::conflate);
+
+    accepted = server.PushSignals(block);
+    ASSERT_EQ((std::vector<bool>{ true, false, false, true, true }), accepted);
+
+    pending = server.TakePendingUpdates();
+    ASSERT_EQ((VecSignal{ block[4], block[3] }), pending);
+}
+
+TEST(ServerTest, PipelineStatsShardPerThread)
+{
+    PipelineStats stats;
+    ASSERT_EQ(0, stats.GetShardCount());
+
+    stats.Enable(true);
+
+    // every recording thread gets a shard of its own, kept after the thread ends
+    const int NUM_THREADS = 12;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        threads.emplace_back([&stats, t]()
+            {
+                for (int i = 0; i < 1000; i++)
+                {
+                    stats.Record(EStage::batch_size, t + 1);
+                }
+            });
+    }
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+
+    stats.Record(EStage::batch_size, 100);
+    stats.Record(EStage::encode, 5);
+
+    ASSERT_EQ(NUM_THREADS + 1, stats.GetShardCount());
+
+    Histogram h;
+    stats.Collect(EStage::batch_size, h);
+    ASSERT_EQ(NUM_THREADS * 1000 + 1, h.Count());
+    ASSERT_EQ(100, h.Max());
+
+    // another instance recorded into from the same thread does not share its shards
+    PipelineStats other;
+    other.Enable(true);
+    other.Record(EStage::batch_size, 1);
+    stats.Record(EStage::batch_size, 1);
+
+    Histogram h_other;
+    other.Collect(EStage::batch_size, h_other);
+    ASSERT_EQ(1, h_other.Count());
+    ASSERT_EQ(NUM_THREADS + 1, stats.GetShardCount());
+
+    stats.Reset();
+    Histogram h_reset;
+    stats.Collect(EStage::batch_size, h_reset);
+    ASSERT_EQ(0, h_reset.Count());
+}
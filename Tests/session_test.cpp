@@ -2,8 +2,13 @@
 
 #include <gtest/gtest.h>
 #include <boost/asio.hpp>
+#include <thread>
+#include <map>
+#include <functional>
+#include <algorithm>
 #include "Session.h"
 #include "Server.h"
+#include "Codec.h"
 
 
 TEST(SessionBasic, Construct) 
@@ -14,4 +19,496 @@ TEST(SessionBasic, Construct)
 
 	auto s = std::make_shared<Session>(std::move(sock), server);
 	EXPECT_TRUE(s != nullptr);
-}
\ No newline at end of file
+}
+
+namespace
+{
+    using tcp = boost::asio::ip::tcp;
+
+    // server session over a loopback connection with small socket buffers
+    struct SessionFixture
+    {
+        boost::asio::io_context io;
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work{ boost::asio::make_work_guard(io) };
+        Server server{ io, 0 };
+        tcp::socket client{ io };
+        std::shared_ptr<Session> session;
+        std::thread th;
+
+        SessionFixture(const SlowConsumerPolicy& policy, const VecSignal& signals, const WireFormat& format = WireFormat())
+        {
+            server.EnableShowLogMsg(false);
+            server.EnableDataEmulation(false);
+            server.SetSlowConsumerPolicy(policy);
+            server.SetSignalsAndWait(signals);
+
+            tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+
+            client.open(tcp::v4());
+            client.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+            client.connect(acceptor.local_endpoint());
+
+            tcp::socket server_socket = acceptor.accept();
+            server_socket.set_option(boost::asio::socket_base::send_buffer_size(4096));
+
+            session = std::make_shared<Session>(std::move(server_socket), server);
+
+            th = std::thread([this]() { io.run(); });
+            session->Start();
+
+            // subscribe to all types
+            SubscribeRequest req;
+            req.mask = (uint8_t)(ESignalType::discret | ESignalType::analog);
+            req.format = format;
+            std::vector<uint8_t> payload = encode_subscribe(req);
+
+            SSignalProtocolHeader hdr = make_header(0x01, 0, static_cast<uint32_t>(payload.size()));
+            std::vector<uint8_t> frame(sizeof(hdr) + payload.size());
+            std::memcpy(frame.data(), &hdr, sizeof(hdr));
+            std::memcpy(frame.data() + sizeof(hdr), payload.data(), payload.size());
+            boost::asio::write(client, boost::asio::buffer(frame));
+
+            client.non_blocking(true);
+        }
+
+        ~SessionFixture()
+        {
+            session->ForceClose();
+            server.Stop();
+            work.reset();
+            th.join();
+        }
+
+        // read exactly buf.size() bytes, false on timeout or error
+        bool read_exact(std::vector<uint8_t>& buf, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            size_t pos = 0;
+
+            while (pos < buf.size())
+            {
+                boost::system::error_code ec;
+                pos += client.read_some(boost::asio::buffer(buf.data() + pos, buf.size() - pos), ec);
+
+                if (ec == boost::asio::error::would_block)
+                {
+                    if (std::chrono::steady_clock::now() > deadline)
+                    {
+                        return false;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                else if (ec)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // read one frame
+        bool read_raw(SSignalProtocolHeader& hdr, std::vector<uint8_t>& body)
+        {
+            std::vector<uint8_t> buf(sizeof(SSignalProtocolHeader));
+            if (!read_exact(buf))
+            {
+                return false;
+            }
+            std::memcpy(&hdr, buf.data(), sizeof(hdr));
+
+            body.resize(net_to_host_u32(hdr.len));
+            return read_exact(body);
+        }
+
+        // read one data frame and decode its records
+        bool read_frame(uint8_t& msg_num, VecSignal& out)
+        {
+            SSignalProtocolHeader hdr;
+            std::vector<uint8_t> buf;
+            if (!read_raw(hdr, buf))
+            {
+                return false;
+            }
+            msg_num = hdr.msg_num;
+
+            out.clear();
+            for (size_t pos = 0; pos + SIGNAL_RECORD_SIZE <= buf.size(); pos += SIGNAL_RECORD_SIZE)
+            {
+                Signal s;
+                decode_signal(buf.data() + pos, s);
+                out.push_back(s);
+            }
+
+            return true;
+        }
+    };
+
+    VecSignal make_analog_signals(int count)
+    {
+        VecSignal signals;
+        for (int i = 1; i <= count; i++)
+        {
+            signals.emplace_back(i, ESignalType::analog, 0.0);
+        }
+        return signals;
+    }
+}
+
+
+TEST(SessionTest, SlowConsumerConflation)
+{
+    const int NUM_SIGNALS = 100;
+    const int NUM_ROUNDS = 1000;
+
+    SlowConsumerPolicy policy;
+    policy.max_queue_bytes = 16 * 1024;
+    policy.max_stall = std::chrono::milliseconds(0);
+
+    SessionFixture f(policy, make_analog_signals(NUM_SIGNALS));
+
+    // snapshot
+    uint8_t msg_num;
+    VecSignal records;
+    ASSERT_TRUE(f.read_frame(msg_num, records));
+    ASSERT_EQ(0, msg_num);
+    ASSERT_EQ(NUM_SIGNALS, records.size());
+
+    // the client does not read while the updates are pushed
+    for (int round = 1; round <= NUM_ROUNDS; round++)
+    {
+        for (int id = 1; id <= NUM_SIGNALS; id++)
+        {
+            f.server.PushSignal({ (uint32_t)id, ESignalType::analog, double(round), std::chrono::steady_clock::now() });
+        }
+    }
+
+    // drain: every signal must end with its newest value, with fewer records than updates
+    std::map<uint32_t, double> values;
+    int cnt_final = 0;
+    int cnt_records = 0;
+    uint8_t expected_msg_num = 1;
+
+    while (cnt_final < NUM_SIGNALS)
+    {
+        ASSERT_TRUE(f.read_frame(msg_num, records)) << "final values not received";
+        ASSERT_EQ(expected_msg_num++, msg_num);
+
+        for (const auto& s : records)
+        {
+            if (s.value == NUM_ROUNDS && values[s.id] != NUM_ROUNDS)
+            {
+                cnt_final++;
+            }
+            values[s.id] = s.value;
+            cnt_records++;
+        }
+    }
+
+    ASSERT_LT(cnt_records, NUM_SIGNALS * NUM_ROUNDS);
+    ASSERT_FALSE(f.session->Expired());
+}
+
+TEST(SessionTest, LargeSnapshotIsStreamed)
+{
+    const int NUM_SIGNALS = 40000;      // ~10 snapshot frames, several times the queue limit
+
+    SlowConsumerPolicy policy;
+    policy.max_queue_bytes = 128 * 1024;
+    policy.max_stall = std::chrono::milliseconds(0);
+
+    SessionFixture f(policy, make_analog_signals(NUM_SIGNALS));
+
+    uint8_t msg_num;
+    VecSignal records;
+    ASSERT_TRUE(f.read_frame(msg_num, records));
+    ASSERT_EQ(0, msg_num);
+
+    // an update while the rest of the snapshot is still to send: queued behind it, not conflated
+    for (int id = 1; id <= 100; id++)
+    {
+        f.server.PushSignal({ (uint32_t)id, ESignalType::analog, 1.0, std::chrono::steady_clock::now() });
+    }
+
+    size_t cnt_snapshot = records.size();
+    uint8_t expected_msg_num = 1;
+
+    while (cnt_snapshot < NUM_SIGNALS)
+    {
+        ASSERT_TRUE(f.read_frame(msg_num, records));
+        ASSERT_EQ(expected_msg_num++, msg_num);
+        ASSERT_TRUE(std::all_of(records.begin(), records.end(), [](const Signal& s) { return s.value == 0.0; }));
+        cnt_snapshot += records.size();
+    }
+    ASSERT_EQ(NUM_SIGNALS, cnt_snapshot);
+
+    // then the update, in as many frames as the dispatcher took batches
+    size_t cnt_updates = 0;
+    while (cnt_updates < 100)
+    {
+        ASSERT_TRUE(f.read_frame(msg_num, records));
+        ASSERT_EQ(expected_msg_num++, msg_num);
+        ASSERT_TRUE(std::all_of(records.begin(), records.end(), [](const Signal& s) { return s.value == 1.0; }));
+        cnt_updates += records.size();
+    }
+    ASSERT_EQ(100, cnt_updates);
+
+    ASSERT_EQ(0, f.server.GetCounters().slow_consumer_events.Value());
+}
+
+TEST(SessionTest, StalledConsumerDisconnected)
+{
+    const int NUM_SIGNALS = 100;
+
+    SlowConsumerPolicy policy;
+    policy.max_queue_bytes = 16 * 1024;
+    policy.max_stall = std::chrono::milliseconds(200);
+
+    SessionFixture f(policy, make_analog_signals(NUM_SIGNALS));
+
+    // the client never reads: updates until the session conflates, then none
+    auto start = std::chrono::steady_clock::now();
+    int round = 0;
+    while (f.server.GetCounters().slow_consumer_events.Value() == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        round++;
+        for (int id = 1; id <= NUM_SIGNALS; id++)
+        {
+            f.server.PushSignal({ (uint32_t)id, ESignalType::analog, double(round), std::chrono::steady_clock::now() });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    ASSERT_GT(f.server.GetCounters().slow_consumer_events.Value(), 0u);
+
+    // the timer wheel check closes it without another update (heartbeats and the drain timeout off)
+    HeartbeatPolicy heartbeat;
+    heartbeat.alive_interval = std::chrono::milliseconds(0);
+    heartbeat.drain_timeout = std::chrono::milliseconds(0);
+
+    start = std::chrono::steady_clock::now();
+    while (!f.session->Expired() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        f.session->CheckTimeouts(std::chrono::steady_clock::now(), heartbeat);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ASSERT_TRUE(f.session->Expired());
+}
+
+TEST(SessionTest, ConflatedFrameKeepsSequence)
+{
+    const int NUM_SIGNALS = 100;
+    const int NUM_ROUNDS = 1000;
+
+    SlowConsumerPolicy policy;
+    policy.max_queue_bytes = 16 * 1024;
+    policy.max_stall = std::chrono::milliseconds(0);
+
+    WireFormat format;
+    format.version = 2;
+    format.options = WIRE_OPT_SEQUENCE;
+
+    SessionFixture f(policy, make_analog_signals(NUM_SIGNALS), format);
+
+    // the client does not read while the updates are pushed
+    const uint64_t first_seq = f.server.GetSequence();
+    for (int round = 1; round <= NUM_ROUNDS; round++)
+    {
+        for (int id = 1; id <= NUM_SIGNALS; id++)
+        {
+            f.server.PushSignal({ (uint32_t)id, ESignalType::analog, double(round), std::chrono::steady_clock::now() });
+        }
+    }
+
+    // ... nor until every batch has reached the session, so that the last ones are conflated too
+    auto start = std::chrono::steady_clock::now();
+    while (f.server.GetSequence() != first_seq + NUM_SIGNALS * NUM_ROUNDS && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // the frame with the conflated values moves the client to the last update, like the frames it replaces
+    SSignalProtocolHeader hdr;
+    std::vector<uint8_t> body;
+    std::map<uint32_t, double> values;
+    uint64_t last_seq = 0;
+
+    auto done = [&]()
+        {
+            return values.size() == NUM_SIGNALS && last_seq == f.server.GetSequence() &&
+                std::all_of(values.begin(), values.end(), [](const std::pair<const uint32_t, double>& v) { return v.second == NUM_ROUNDS; });
+        };
+
+    while (!done())
+    {
+        ASSERT_TRUE(f.read_raw(hdr, body)) << "last position not received, at " << last_seq << " of " << f.server.GetSequence();
+        ASSERT_EQ(0x02, hdr.data_type);
+
+        FrameSeq pos;
+        ASSERT_TRUE(decode_signals_v2(body.data(), body.size(), [&](const Signal& s) { values[s.id] = s.value; }, &pos));
+        last_seq = std::max(last_seq, pos.seq);
+    }
+
+    ASSERT_GT(f.server.GetCounters().slow_consumer_events.Value(), 0u);
+}
+
+TEST(SessionTest, ClosedSessionLeavesRegistry)
+{
+    SessionFixture f(SlowConsumerPolicy(), make_analog_signals(1));
+
+    auto wait_for = [](const std::function<bool()>& pred)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (!pred() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return pred();
+    };
+
+    // registrations are applied without waiting for data
+    ASSERT_TRUE(wait_for([&]() { return f.server.GetSubscriberCount() == 1; }));
+
+    // disconnects are applied without waiting for data
+    f.session->ForceClose();
+
+    ASSERT_TRUE(wait_for([&]() { return f.server.GetSubscriberCount() == 0; }));
+    ASSERT_TRUE(wait_for([&]() { return f.session.use_count() == 1; }));
+}
+
+namespace
+{
+    // server with an accepting io thread and a raw client connection
+    struct HeartbeatFixture
+    {
+        boost::asio::io_context io;
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work{ boost::asio::make_work_guard(io) };
+        Server server{ io, 0 };
+        tcp::socket client{ io };
+        std::thread th;
+
+        explicit HeartbeatFixture(const HeartbeatPolicy& policy)
+        {
+            server.EnableShowLogMsg(false);
+            server.EnableDataEmulation(false);
+            server.SetHeartbeatPolicy(policy);
+            server.SetSignalsAndWait(make_analog_signals(1));
+            server.Start();
+
+            th = std::thread([this]() { io.run(); });
+
+            client.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.GetPort()));
+            client.non_blocking(true);
+        }
+
+        ~HeartbeatFixture()
+        {
+            server.Stop();
+            work.reset();
+            th.join();
+        }
+
+        void subscribe()
+        {
+            SSignalProtocolHeader hdr = make_header(0x01, 0, 1);
+            std::vector<uint8_t> frame(sizeof(hdr) + 1);
+            std::memcpy(frame.data(), &hdr, sizeof(hdr));
+            frame[sizeof(hdr)] = (uint8_t)ESignalType::analog;
+            boost::asio::write(client, boost::asio::buffer(frame));
+        }
+
+        // read headers (skipping bodies) until a frame of data_type arrives
+        bool wait_frame(uint8_t data_type, std::chrono::milliseconds timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            std::vector<uint8_t> buf;
+
+            while (std::chrono::steady_clock::now() < deadline)
+            {
+                uint8_t tmp[256];
+                boost::system::error_code ec;
+                size_t n = client.read_some(boost::asio::buffer(tmp), ec);
+
+                if (ec == boost::asio::error::would_block)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    continue;
+                }
+                if (ec)
+                {
+                    return false;
+                }
+                buf.insert(buf.end(), tmp, tmp + n);
+
+                while (buf.size() >= sizeof(SSignalProtocolHeader))
+                {
+                    SSignalProtocolHeader hdr;
+                    std::memcpy(&hdr, buf.data(), sizeof(hdr));
+                    size_t frame_size = sizeof(hdr) + net_to_host_u32(hdr.len);
+                    if (buf.size() < frame_size)
+                    {
+                        break;
+                    }
+                    if (hdr.data_type == data_type)
+                    {
+                        return true;
+                    }
+                    buf.erase(buf.begin(), buf.begin() + frame_size);
+                }
+            }
+
+            return false;
+        }
+
+        // true if the server closed the connection within timeout
+        bool wait_closed(std::chrono::milliseconds timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+
+            while (std::chrono::steady_clock::now() < deadline)
+            {
+                uint8_t tmp[256];
+                boost::system::error_code ec;
+                client.read_some(boost::asio::buffer(tmp), ec);
+
+                if (ec == boost::asio::error::would_block)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                else if (ec)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+    };
+}
+
+TEST(SessionTest, HeartbeatOnIdle)
+{
+    HeartbeatPolicy policy;
+    policy.alive_interval = std::chrono::milliseconds(100);
+    policy.tick = std::chrono::milliseconds(10);
+    policy.wheel_slots = 4;
+
+    HeartbeatFixture f(policy);
+    f.subscribe();
+
+    ASSERT_TRUE(f.wait_frame(0x03, std::chrono::seconds(3)));
+}
+
+TEST(SessionTest, UnsubscribedPeerReaped)
+{
+    HeartbeatPolicy policy;
+    policy.drain_timeout = std::chrono::milliseconds(200);
+    policy.tick = std::chrono::milliseconds(10);
+    policy.wheel_slots = 4;
+
+    // connected, never subscribes
+    HeartbeatFixture f(policy);
+
+    ASSERT_TRUE(f.wait_closed(std::chrono::seconds(3)));
+}
@@ -0,0 +1,210 @@
+// store_test.cpp
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include "SignalStore.h"
+
+using steady_clock = std::chrono::steady_clock;
+
+
+TEST(SignalStoreTest, UpdateAndGet)
+{
+    SignalStore store;
+
+    store.Reset({ {1, ESignalType::discret, 0.0}, {2, ESignalType::analog, 10.0} });
+    ASSERT_EQ(2, store.Size());
+
+    Signal s;
+    ASSERT_TRUE(store.Get(2, s));
+    ASSERT_EQ(Signal(2, ESignalType::analog, 10.0), s);
+
+    // unknown id
+    ASSERT_FALSE(store.Get(3, s));
+    ASSERT_FALSE(store.Update({ 3, ESignalType::analog, 1.0 }));
+
+    auto now = steady_clock::now();
+    ASSERT_TRUE(store.Update({ 2, ESignalType::analog, 11.0, now }));
+
+    // older value is rejected
+    ASSERT_FALSE(store.Update({ 2, ESignalType::analog, 12.0, now - std::chrono::seconds(1) }));
+
+    ASSERT_TRUE(store.Get(2, s));
+    ASSERT_EQ(Signal(2, ESignalType::analog, 11.0), s);
+    ASSERT_EQ(now, s.ts);
+}
+
+TEST(SignalStoreTest, SnapshotAndReset)
+{
+    SignalStore store;
+
+    // duplicate id: the last one wins
+    store.Reset({ {1, ESignalType::discret, 0.0}, {2, ESignalType::analog, 10.0}, {3, ESignalType::discret, 1.0}, {1, ESignalType::discret, 1.0} });
+    ASSERT_EQ(3, store.Size());
+
+    auto discret = store.Snapshot((uint8_t)ESignalType::discret);
+    ASSERT_EQ(2, discret.size());
+    ASSERT_EQ(Signal(1, ESignalType::discret, 1.0), discret[0]);
+    ASSERT_EQ(Signal(3, ESignalType::discret, 1.0), discret[1]);
+
+    store.Reset({ {5, ESignalType::analog, 5.0} });
+
+    Signal s;
+    ASSERT_FALSE(store.Get(1, s));
+    ASSERT_TRUE(store.Get(5, s));
+    ASSERT_EQ(1, store.Snapshot((uint8_t)(ESignalType::discret | ESignalType::analog)).size());
+}
+
+TEST(SignalStoreTest, ConcurrentReadersSeeWholeValues)
+{
+    SignalStore store;
+
+    const int NUM_SIGNALS = 4;
+    VecSignal signals;
+    for (int i = 0; i < NUM_SIGNALS; i++)
+    {
+        signals.emplace_back(i, ESignalType::analog, 0.0);
+    }
+    store.Reset(signals);
+
+    std::atomic<bool> stop{ false };
+    std::atomic<int> torn{ 0 };
+
+    // writers store value == ts, readers check that they never see a mix of two updates
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; w++)
+    {
+        writers.emplace_back([&, w]()
+            {
+                for (int k = 1; k <= 20000; k++)
+                {
+                    int64_t tick = k * 2 + w;
+                    Signal s(k % NUM_SIGNALS, ESignalType::analog, double(tick), Signal::time_point(steady_clock::duration(tick)));
+                    store.Update(s);
+                }
+            });
+    }
+
+    std::thread reader([&]()
+        {
+            Signal s;
+            while (!stop)
+            {
+                for (int i = 0; i < NUM_SIGNALS; i++)
+                {
+                    store.Get(i, s);
+                    if (s.value != double(s.ts.time_since_epoch().count()))
+                    {
+                        torn++;
+                    }
+                }
+            }
+        });
+
+    for (auto& w : writers)
+    {
+        w.join();
+    }
+    stop = true;
+    reader.join();
+
+    ASSERT_EQ(0, torn.load());
+}
+
+TEST(SignalStoreTest, ResetCarriesLiveValues)
+{
+    SignalStore store;
+
+    store.Reset({ {1, ESignalType::analog, 0.0}, {2, ESignalType::analog, 0.0}, {3, ESignalType::analog, 0.0} });
+    ASSERT_TRUE(store.Update({ 1, ESignalType::analog, 5.0, steady_clock::now() }));
+    ASSERT_TRUE(store.Update({ 2, ESignalType::analog, 6.0, steady_clock::now() }));
+    ASSERT_TRUE(store.Update({ 3, ESignalType::analog, 7.0, steady_clock::now() }));
+
+    // 1 is carried, 2 takes the given value, 3 changed its type
+    store.Reset({ {1, ESignalType::analog, 0.0}, {2, ESignalType::analog, 1.0}, {3, ESignalType::discret, 1.0} }, { 1, 3 });
+
+    Signal s;
+    ASSERT_TRUE(store.Get(1, s));
+    ASSERT_EQ(5.0, s.value);
+    ASSERT_TRUE(store.Get(2, s));
+    ASSERT_EQ(1.0, s.value);
+    ASSERT_TRUE(store.Get(3, s));
+    ASSERT_EQ(Signal(3, ESignalType::discret, 1.0), s);
+}
+
+TEST(SignalStoreTest, UpdatesRacingResetAreNotLost)
+{
+    SignalStore store;
+
+    const VecSignal signals = { {0, ESignalType::analog, 0.0}, {1, ESignalType::analog, 0.0} };
+    store.Reset(signals);
+
+    const int NUM_UPDATES = 100000;
+    std::atomic<bool> done{ false };
+
+    std::thread writer([&]()
+        {
+            for (int k = 1; k <= NUM_UPDATES; k++)
+            {
+                store.Update({ 0, ESignalType::analog, double(k), Signal::time_point(steady_clock::duration(k)) });
+            }
+            done = true;
+        });
+
+    int resets = 0;
+    while (!done || resets < 100)
+    {
+        store.Reset(signals, { 0 });
+        resets++;
+    }
+    writer.join();
+
+    Signal s;
+    ASSERT_TRUE(store.Get(0, s));
+    ASSERT_EQ(double(NUM_UPDATES), s.value);
+}
+
+TEST(SignalStoreTest, StoresSharedByThreads)
+{
+    // threads alternating between two stores while one of them is replaced
+    SignalStore a;
+    SignalStore b;
+
+    const VecSignal signals = { {0, ESignalType::analog, 0.0} };
+    a.Reset(signals);
+    b.Reset(signals);
+
+    const int NUM_UPDATES = 20000;
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 4; w++)
+    {
+        writers.emplace_back([&, w]()
+            {
+                for (int k = 1; k <= NUM_UPDATES; k++)
+                {
+                    const int64_t tick = k * 4 + w;
+                    a.Update({ 0, ESignalType::analog, double(tick), Signal::time_point(steady_clock::duration(tick)) });
+                    b.Update({ 0, ESignalType::analog, double(tick), Signal::time_point(steady_clock::duration(tick)) });
+                }
+            });
+    }
+
+    for (int i = 0; i < 200; i++)
+    {
+        a.Reset(signals, { 0 });
+    }
+
+    for (auto& w : writers)
+    {
+        w.join();
+    }
+
+    // both end with the newest update
+    Signal s;
+    ASSERT_TRUE(a.Get(0, s));
+    ASSERT_EQ(double(NUM_UPDATES * 4 + 3), s.value);
+    ASSERT_TRUE(b.Get(0, s));
+    ASSERT_EQ(double(NUM_UPDATES * 4 + 3), s.value);
+}
@@ -115,7 +115,7 @@ TEST(StressTest, MultipleClientsLoadTest)
             {3, ESignalType::discret, 1 },
             {4, ESignalType::analog, -12.0}
         };
-        server.SetSignals(test_signals);
+        server.SetSignalsAndWait(test_signals);
 
 
         server.Start();
@@ -139,7 +139,7 @@ TEST(StressTest, MultipleClientsLoadTest)
         using client_work_guard_t = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
         std::vector<client_work_guard_t> client_work_guards;
 
-        const int num_signal_wait = (NUM_CYCLES + 1) * test_signals.size(); // +1: first full packet with signals - from { server.SetSignals(test_signals) }
+        const int num_signal_wait = (NUM_CYCLES + 1) * test_signals.size(); // +1: first full packet with signals - from { server.SetSignalsAndWait(test_signals) }
 
         // create & run clients
         int cnt = 0;
@@ -265,4 +265,206 @@ TEST(StressTest, MultipleClientsLoadTest)
     }
 
 
-}
\ No newline at end of file
+}
+
+// deliveries/s (signals received by all clients) for a server running `threads` io threads
+static double measure_fan_out(size_t threads, EAcceptMode mode, size_t fanout_threads, int num_clients, int num_cycles)
+{
+    IoPool server_pool(threads);
+    Server server(server_pool, 0, mode);
+
+    server.SetFanOutThreads(fanout_threads);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+    server_pool.Run();
+
+    VecSignal test_signals =
+    {
+        {1, ESignalType::discret, 0},
+        {2, ESignalType::analog, 10.0},
+        {3, ESignalType::discret, 1 },
+        {4, ESignalType::analog, -12.0}
+    };
+    server.SetSignalsAndWait(test_signals);
+    server.Start();
+
+    std::atomic<int> ready_clients_count{ 0 };
+    std::atomic<int> finished_clients_count{ 0 };
+    const int num_signal_wait = (num_cycles + 1) * test_signals.size();
+
+    IoPool client_pool(2);
+    std::vector<std::unique_ptr<StressClient>> clients;
+
+    for (int i = 0; i < num_clients; ++i)
+    {
+        clients.emplace_back(std::make_unique<StressClient>(client_pool.Next(), "127.0.0.1", server.GetPort(), 
+            std::ref(ready_clients_count), std::ref(finished_clients_count), num_signal_wait));
+        clients.back()->EnableShowLogMsg(false);
+    }
+
+    client_pool.Run();
+    for (auto& client : clients)
+    {
+        client->Start();
+    }
+
+    double result = 0;
+    const auto timeout = std::chrono::seconds(25);
+    auto start_time = std::chrono::steady_clock::now();
+
+    while (ready_clients_count.load() < num_clients && std::chrono::steady_clock::now() - start_time < timeout)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    if (ready_clients_count.load() == num_clients)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < num_cycles; ++i)
+        {
+            server.PushSignals(test_signals);
+        }
+
+        while (finished_clients_count.load() < num_clients && std::chrono::steady_clock::now() - start_time < timeout)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        auto t1 = std::chrono::steady_clock::now();
+
+        if (finished_clients_count.load() == num_clients)
+        {
+            result = double(num_clients) * num_cycles * test_signals.size() / std::chrono::duration<double>(t1 - t0).count();
+        }
+    }
+
+    client_pool.Stop();
+    clients.clear();
+
+    server.Stop();
+    server_pool.Stop();
+
+    return result;
+}
+
+TEST(StressTest, FanOutScaling)
+{
+    const int NUM_SCALING_CLIENTS = 20;
+    const int NUM_SCALING_CYCLES = 5000;
+
+    struct Run
+    {
+        size_t threads;
+        EAcceptMode mode;
+        size_t fanout_threads;
+        int clients;
+    };
+
+    std::vector<Run> runs = 
+    { 
+        { 1, EAcceptMode::round_robin, 0, NUM_SCALING_CLIENTS }, 
+        { 2, EAcceptMode::round_robin, 0, NUM_SCALING_CLIENTS }, 
+        { 4, EAcceptMode::round_robin, 0, NUM_SCALING_CLIENTS }, 
+        { 4, EAcceptMode::reuse_port, 0, NUM_SCALING_CLIENTS },
+        { 4, EAcceptMode::round_robin, 0, 10 * NUM_SCALING_CLIENTS },
+        { 4, EAcceptMode::round_robin, 4, 10 * NUM_SCALING_CLIENTS },
+    };
+
+    for (const auto& run : runs)
+    {
+        double rate = measure_fan_out(run.threads, run.mode, run.fanout_threads, run.clients, NUM_SCALING_CYCLES);
+
+        std::cout << "\nFan-out, " << run.clients << " clients, " << run.threads << " io thread(s), " 
+            << (run.mode == EAcceptMode::reuse_port ? "reuseport" : "round-robin") << ", " << run.fanout_threads << " fan-out thread(s)"
+            << ": " << rate / 1e6 << " M deliveries/s";
+
+        ASSERT_GT(rate, 0) << "not all clients received the updates";
+    }
+    std::cout << "\n";
+}
+
+TEST(StressTest, FanOutThreadsChangedUnderLoad)
+{
+    const int NUM_CLIENTS = 200;    // enough sessions for several fan-out shards
+    const int NUM_CYCLES = 2000;
+
+    IoPool server_pool(4);
+    Server server(server_pool, 0);
+
+    server.SetFanOutThreads(4);
+    server.EnableDataEmulation(false);
+    server.EnableShowLogMsg(false);
+    server_pool.Run();
+
+    VecSignal test_signals =
+    {
+        {1, ESignalType::discret, 0},
+        {2, ESignalType::analog, 10.0},
+    };
+    server.SetSignalsAndWait(test_signals);
+    server.Start();
+
+    std::atomic<int> ready_clients_count{ 0 };
+    std::atomic<int> finished_clients_count{ 0 };
+    const int num_signal_wait = (NUM_CYCLES + 1) * test_signals.size();
+
+    IoPool client_pool(2);
+    std::vector<std::unique_ptr<StressClient>> clients;
+
+    for (int i = 0; i < NUM_CLIENTS; ++i)
+    {
+        clients.emplace_back(std::make_unique<StressClient>(client_pool.Next(), "127.0.0.1", server.GetPort(),
+            std::ref(ready_clients_count), std::ref(finished_clients_count), num_signal_wait));
+        clients.back()->EnableShowLogMsg(false);
+    }
+
+    client_pool.Run();
+    for (auto& client : clients)
+    {
+        client->Start();
+    }
+
+    const auto timeout = std::chrono::seconds(25);
+    auto start_time = std::chrono::steady_clock::now();
+
+    while (ready_clients_count.load() < NUM_CLIENTS && std::chrono::steady_clock::now() - start_time < timeout)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(NUM_CLIENTS, ready_clients_count.load());
+
+    // the pool is replaced while the dispatcher fans batches out on it
+    std::atomic<bool> pushing{ true };
+    std::thread resizer([&]()
+        {
+            size_t threads = 0;
+            while (pushing)
+            {
+                server.SetFanOutThreads(threads++ % 5);
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        });
+
+    for (int i = 0; i < NUM_CYCLES; ++i)
+    {
+        server.PushSignals(test_signals);
+    }
+
+    while (finished_clients_count.load() < NUM_CLIENTS && std::chrono::steady_clock::now() - start_time < timeout)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    pushing = false;
+    resizer.join();
+
+    // every session received every update
+    ASSERT_EQ(NUM_CLIENTS, finished_clients_count.load());
+
+    client_pool.Stop();
+    clients.clear();
+
+    server.Stop();
+    server_pool.Stop();
+}
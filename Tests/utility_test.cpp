@@ -2,6 +2,8 @@
 
 #include "gtest/gtest.h"
 #include "Utils.h"
+#include "Codec.h"
+#include "Histogram.h"
 
 
 TEST(UtilityTest, HostToNet16Conversion) 
@@ -47,4 +49,356 @@ TEST(UtilityTest, HostToNet64Conversion)
 
     // Checking that the inverse transformation works
     ASSERT_EQ(host_value, net_to_host_u64(expected_net_value));
-}
\ No newline at end of file
+}
+TEST(UtilityTest, SignalRecordRoundTrip)
+{
+    VecSignal signals =
+    {
+        {1, ESignalType::discret, 1.0},
+        {2, ESignalType::analog, -12.25},
+        {0x01020304, ESignalType::analog, 1e300},
+    };
+
+    // only analog
+    std::vector<uint8_t> payload;
+    encode_signals(signals, (uint8_t)ESignalType::analog, payload);
+    ASSERT_EQ(2 * SIGNAL_RECORD_SIZE, payload.size());
+
+    // id in network byte order
+    ASSERT_EQ(0x00, payload[0]);
+    ASSERT_EQ(0x02, payload[3]);
+
+    Signal s;
+    decode_signal(payload.data(), s);
+    ASSERT_EQ(signals[1], s);
+
+    decode_signal(payload.data() + SIGNAL_RECORD_SIZE, s);
+    ASSERT_EQ(signals[2], s);
+}
+
+TEST(UtilityTest, SubscribeRoundTrip)
+{
+    SubscribeRequest req;
+    req.mask = (uint8_t)ESignalType::analog;
+    req.filter_ids = true;
+    req.id_ranges = { { 10, 20 }, { 5, 5 }, { 15, 30 }, { 100, 100000 } };
+
+    std::vector<uint8_t> payload = encode_subscribe(req);
+
+    // unknown sections are skipped
+    append_section(payload, 200, { 1, 2, 3 });
+
+    SubscribeRequest out;
+    ASSERT_TRUE(decode_subscribe(payload, out));
+    ASSERT_EQ(req.mask, out.mask);
+    ASSERT_TRUE(out.filter_ids);
+
+    // normalized: sorted and merged
+    ASSERT_EQ(3, out.id_ranges.size());
+    ASSERT_EQ(5, out.id_ranges[0].first);
+    ASSERT_EQ(10, out.id_ranges[1].first);
+    ASSERT_EQ(30, out.id_ranges[1].last);
+
+    ASSERT_TRUE(id_in_ranges(out.id_ranges, 5));
+    ASSERT_FALSE(id_in_ranges(out.id_ranges, 6));
+    ASSERT_TRUE(id_in_ranges(out.id_ranges, 30));
+    ASSERT_TRUE(id_in_ranges(out.id_ranges, 5000));
+    ASSERT_FALSE(id_in_ranges(out.id_ranges, 100001));
+
+    // plain mask byte (version 1 clients)
+    ASSERT_TRUE(decode_subscribe({ 0x03 }, out));
+    ASSERT_FALSE(out.filter_ids);
+
+    // truncated section
+    payload.pop_back();
+    ASSERT_FALSE(decode_subscribe(payload, out));
+
+    // too many ranges
+    req.id_ranges.clear();
+    for (uint32_t i = 0; i <= MAX_ID_RANGES; i++)
+    {
+        req.id_ranges.push_back({ i * 10, i * 10 + 1 });
+    }
+    ASSERT_FALSE(decode_subscribe(encode_subscribe(req), out));
+
+    req.id_ranges.pop_back();
+    ASSERT_TRUE(decode_subscribe(encode_subscribe(req), out));
+    ASSERT_EQ(MAX_ID_RANGES, out.id_ranges.size());
+}
+
+TEST(UtilityTest, SignalRecordV2RoundTrip)
+{
+    VecSignal signals =
+    {
+        {700, ESignalType::analog, 3.14159},
+        {5, ESignalType::discret, 1.0},
+        {6, ESignalType::discret, 0.0},
+        {100000, ESignalType::analog, -1e-300},
+        {5, ESignalType::discret, 0.0},     // repeated id keeps its order
+        {701, ESignalType::analog, 3.14159},
+    };
+
+    auto decode = [](const std::vector<uint8_t>& payload)
+        {
+            VecSignal out;
+            EXPECT_TRUE(decode_signals_v2(payload.data(), payload.size(), [&](const Signal& s) { out.push_back(s); }));
+            return out;
+        };
+
+    std::vector<uint8_t> payload;
+    encode_signals_v2(signals, (uint8_t)(ESignalType::discret | ESignalType::analog), 0, payload);
+    ASSERT_LT(payload.size(), signals.size() * SIGNAL_RECORD_SIZE);
+
+    // sorted by id, values exact
+    VecSignal out = decode(payload);
+    ASSERT_EQ(signals.size(), out.size());
+    ASSERT_EQ(5, out[0].id);
+    ASSERT_EQ(1.0, out[0].value);
+    ASSERT_EQ(5, out[1].id);
+    ASSERT_EQ(0.0, out[1].value);
+    ASSERT_EQ(signals[0], out[3]);
+    ASSERT_EQ(signals[5], out[4]);
+    ASSERT_EQ(signals[3].value, out[5].value);
+
+    // discrete values other than 0 / 1 are not bit-packed
+    signals[1].value = 2.0;
+    encode_signals_v2(signals, (uint8_t)ESignalType::discret, 0, payload);
+    out = decode(payload);
+    ASSERT_EQ(3, out.size());
+    ASSERT_EQ(2.0, out[0].value);
+
+    // float32 analogs
+    encode_signals_v2(signals, (uint8_t)ESignalType::analog, WIRE_OPT_FLOAT32, payload);
+    out = decode(payload);
+    ASSERT_EQ(3, out.size());
+    ASSERT_EQ((double)(float)3.14159, out[0].value);
+
+    // nothing matches: empty payload
+    encode_signals_v2(VecSignal(), (uint8_t)ESignalType::analog, 0, payload);
+    ASSERT_TRUE(payload.empty());
+
+    // truncated
+    encode_signals_v2(signals, (uint8_t)ESignalType::analog, 0, payload);
+    payload.pop_back();
+    ASSERT_FALSE(decode_signals_v2(payload.data(), payload.size(), [](const Signal&) {}));
+}
+
+TEST(UtilityTest, SignalRecordV2Timestamps)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    VecSignal signals =
+    {
+        {2, ESignalType::analog, 1.5, now - std::chrono::milliseconds(3)},
+        {1, ESignalType::discret, 1.0, now},
+        {3, ESignalType::analog, 2.5},      // no source time
+    };
+
+    std::vector<uint8_t> payload;
+    encode_signals_v2(signals, (uint8_t)(ESignalType::discret | ESignalType::analog), WIRE_OPT_TIMESTAMPS, payload);
+
+    VecSignal out;
+    ASSERT_TRUE(decode_signals_v2(payload.data(), payload.size(), [&](const Signal& s) { out.push_back(s); }));
+    ASSERT_EQ(3, out.size());
+
+    // microsecond resolution, the clock offset may move by a few microseconds between encode and decode
+    auto diff_us = [](Signal::time_point a, Signal::time_point b)
+        {
+            return std::abs(std::chrono::duration_cast<std::chrono::microseconds>(a - b).count());
+        };
+
+    ASSERT_LT(diff_us(now, out[0].ts), 1000);
+    ASSERT_LT(diff_us(now - std::chrono::milliseconds(3), out[1].ts), 1000);
+    ASSERT_EQ(Signal::time_point(), out[2].ts);
+    ASSERT_EQ(2.5, out[2].value);
+}
+
+TEST(UtilityTest, SchemaPayloadRoundTrip)
+{
+    VecSchemaChange changes =
+    {
+        { SCHEMA_ADDED, { 7, ESignalType::analog, 1.5 } },
+        { SCHEMA_REMOVED, { 3, ESignalType::discret } },
+        { SCHEMA_RETYPED, { 9, ESignalType::discret, 1.0 } },
+    };
+
+    SharedPayload payload = make_schema_payload(changes);
+    ASSERT_EQ(3 * SCHEMA_ENTRY_SIZE, payload->size());
+
+    VecSchemaChange out;
+    ASSERT_TRUE(decode_schema_payload(payload->data(), payload->size(), out));
+    ASSERT_EQ(3, out.size());
+
+    for (size_t i = 0; i < changes.size(); i++)
+    {
+        ASSERT_EQ(changes[i].op, out[i].op);
+        ASSERT_EQ(changes[i].signal, out[i].signal);
+    }
+
+    // truncated entry, unknown op
+    ASSERT_FALSE(decode_schema_payload(payload->data(), payload->size() - 1, out));
+
+    std::vector<uint8_t> bad(*payload);
+    bad[0] = 0;
+    ASSERT_FALSE(decode_schema_payload(bad.data(), bad.size(), out));
+}
+
+TEST(UtilityTest, SequencedFrameRoundTrip)
+{
+    VecSignal signals = { { 4, ESignalType::analog, 2.5 }, { 1, ESignalType::discret, 1.0 } };
+    const uint8_t mask = (uint8_t)(ESignalType::discret | ESignalType::analog);
+    const uint64_t seq = (uint64_t(1) << 62) + 5;
+
+    FrameSeq pos;
+    pos.seq = seq;
+    pos.reset = true;
+
+    VecSignal out;
+    FrameSeq out_pos;
+
+    std::vector<uint8_t> payload;
+    encode_signals_v2(signals, mask, WIRE_OPT_SEQUENCE, payload, pos);
+    ASSERT_TRUE(decode_signals_v2(payload.data(), payload.size(), [&](const Signal& s) { out.push_back(s); }, &out_pos));
+    ASSERT_EQ(2, out.size());
+    ASSERT_EQ(seq, out_pos.seq);
+    ASSERT_TRUE(out_pos.reset);
+
+    // not requested: not encoded
+    encode_signals_v2(signals, mask, 0, payload, pos);
+    ASSERT_TRUE(decode_signals_v2(payload.data(), payload.size(), [](const Signal&) {}, &out_pos));
+    ASSERT_EQ(0, out_pos.seq);
+    ASSERT_FALSE(out_pos.reset);
+
+    // a reset goes out without records, a plain position does not
+    out.clear();
+    encode_signals_v2(VecSignal(), mask, WIRE_OPT_SEQUENCE, payload, pos);
+    ASSERT_FALSE(payload.empty());
+    ASSERT_TRUE(decode_signals_v2(payload.data(), payload.size(), [&](const Signal& s) { out.push_back(s); }, &out_pos));
+    ASSERT_TRUE(out.empty());
+    ASSERT_TRUE(out_pos.reset);
+
+    pos.reset = false;
+    encode_signals_v2(VecSignal(), mask, WIRE_OPT_SEQUENCE, payload, pos);
+    ASSERT_TRUE(payload.empty());
+
+    // resume section
+    SubscribeRequest req;
+    req.mask = mask;
+    req.format.version = 2;
+    req.format.options = WIRE_OPT_SEQUENCE;
+    req.resume_seq = seq;
+
+    SubscribeRequest req_out;
+    ASSERT_TRUE(decode_subscribe(encode_subscribe(req), req_out));
+    ASSERT_EQ(seq, req_out.resume_seq);
+    ASSERT_EQ(WIRE_OPT_SEQUENCE, req_out.format.options);
+
+    ASSERT_TRUE(decode_subscribe({ mask }, req_out));
+    ASSERT_EQ(0, req_out.resume_seq);
+}
+
+TEST(UtilityTest, StateDigests)
+{
+    VecSignal signals;
+    for (uint32_t id = 1; id <= 1000; id++)
+    {
+        signals.emplace_back(id, id % 2 ? ESignalType::analog : ESignalType::discret, id % 2 ? id * 0.1 : 1.0);
+    }
+
+    const uint32_t buckets = digest_bucket_count(signals.size());
+    ASSERT_EQ(16, buckets);
+    ASSERT_EQ(1, digest_bucket_count(0));
+    ASSERT_EQ(MAX_DIGEST_BUCKETS, digest_bucket_count(size_t(1) << 40));
+
+    // independent of the order, one changed value changes one bucket
+    const std::vector<uint64_t> digests = compute_digests(signals, buckets);
+
+    VecSignal reversed(signals.rbegin(), signals.rend());
+    ASSERT_EQ(digests, compute_digests(reversed, buckets));
+
+    reversed[10].value += 1.0;
+    std::vector<uint64_t> changed = compute_digests(reversed, buckets);
+    size_t cnt_diff = 0;
+    for (uint32_t b = 0; b < buckets; b++)
+    {
+        cnt_diff += digests[b] != changed[b];
+    }
+    ASSERT_EQ(1, cnt_diff);
+    ASSERT_NE(digests[digest_bucket(reversed[10].id, buckets)], changed[digest_bucket(reversed[10].id, buckets)]);
+
+    // float32 clients hold rounded analogs: the server hashes them rounded as well
+    VecSignal rounded = signals;
+    for (auto& s : rounded)
+    {
+        s.value = static_cast<float>(s.value);
+    }
+    ASSERT_EQ(compute_digests(rounded, buckets), compute_digests(signals, buckets, WIRE_OPT_FLOAT32));
+    ASSERT_NE(compute_digests(rounded, buckets), digests);
+
+    // digest section
+    SubscribeRequest req;
+    req.mask = (uint8_t)ESignalType::analog;
+    req.digests = digests;
+
+    SubscribeRequest out;
+    std::vector<uint8_t> payload = encode_subscribe(req);
+    ASSERT_TRUE(decode_subscribe(payload, out));
+    ASSERT_EQ(digests, out.digests);
+
+    // bucket count not a power of two
+    req.digests.pop_back();
+    ASSERT_FALSE(decode_subscribe(encode_subscribe(req), out));
+
+    // reconcile frame
+    uint32_t out_buckets;
+    std::vector<uint32_t> resent;
+    SharedPayload reconcile = make_reconcile_payload(buckets, { 3, 7 });
+    ASSERT_TRUE(decode_reconcile_payload(reconcile->data(), reconcile->size(), out_buckets, resent));
+    ASSERT_EQ(buckets, out_buckets);
+    ASSERT_EQ(std::vector<uint32_t>({ 3, 7 }), resent);
+
+    reconcile = make_reconcile_payload(buckets, { buckets });
+    ASSERT_FALSE(decode_reconcile_payload(reconcile->data(), reconcile->size(), out_buckets, resent));
+    ASSERT_FALSE(decode_reconcile_payload(reconcile->data(), 3, out_buckets, resent));
+
+    // position only frame
+    FrameSeq pos;
+    size_t cnt = 0;
+    SharedPayload position = make_position_payload(12345);
+    ASSERT_TRUE(decode_signals_v2(position->data(), position->size(), [&](const Signal&) { cnt++; }, &pos));
+    ASSERT_EQ(0, cnt);
+    ASSERT_EQ(12345, pos.seq);
+    ASSERT_FALSE(pos.reset);
+}
+
+TEST(UtilityTest, HistogramPercentiles)
+{
+    Histogram h;
+
+    for (uint64_t v = 1; v <= 10000; v++)
+    {
+        h.Record(v);
+    }
+
+    ASSERT_EQ(10000, h.Count());
+    ASSERT_EQ(10000, h.Max());
+
+    // within the bucket precision (1/64)
+    ASSERT_NEAR(5000, (double)h.Percentile(50), 5000 / 64.0);
+    ASSERT_NEAR(9900, (double)h.Percentile(99), 9900 / 64.0);
+    ASSERT_EQ(10000, h.Percentile(100));
+
+    // small values are exact
+    Histogram small;
+    small.Record(3);
+    small.Record(7);
+    ASSERT_EQ(3, small.Percentile(50));
+    ASSERT_EQ(7, small.Percentile(99.9));
+
+    h.Merge(small);
+    ASSERT_EQ(10002, h.Count());
+
+    h.Reset();
+    ASSERT_EQ(0, h.Count());
+    ASSERT_EQ(0, h.Percentile(99));
+}
@@ -0,0 +1,120 @@
+// Histogram.cpp
+
+#include "Histogram.h"
+#include "Utils.h"
+
+
+Histogram::Histogram()
+    : m_counts(new std::atomic<uint64_t>[BUCKETS])
+{
+    Reset();
+}
+
+size_t Histogram::bucket_index(uint64_t value)
+{
+    if (value < 128)
+    {
+        return static_cast<size_t>(value);
+    }
+
+    // value in [64, 128) << shift
+    unsigned shift = 63 - count_leading_zeros_u64(value) - 6;
+    return 64 * (shift + 1) + static_cast<size_t>((value >> shift) - 64);
+}
+
+uint64_t Histogram::bucket_upper(size_t index)
+{
+    if (index < 128)
+    {
+        return index;
+    }
+
+    unsigned shift = static_cast<unsigned>(index / 64 - 1);
+    uint64_t sub = index % 64 + 64;
+    return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::Record(uint64_t value)
+{
+    m_counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Histogram::Merge(const Histogram& other)
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        uint64_t cnt = other.m_counts[i].load(std::memory_order_relaxed);
+        if (cnt)
+        {
+            m_counts[i].fetch_add(cnt, std::memory_order_relaxed);
+        }
+    }
+    m_count.fetch_add(other.m_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    uint64_t value = other.Max();
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Histogram::Reset()
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        m_counts[i].store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Percentile(double p) const
+{
+    // total from the buckets: a concurrent Record may not be in both counters yet
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        total += m_counts[i].load(std::memory_order_relaxed);
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t upper = bucket_upper(i);
+            uint64_t max = Max();
+            return upper < max ? upper : max;
+        }
+    }
+
+    return Max();
+}
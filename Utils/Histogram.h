@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+
+// Log-linear (HDR style) histogram of non-negative integer values, e.g. latencies in microseconds.
+// Values below 128 are counted exactly, larger ones in 64 linear sub-buckets per power of two
+// (relative error below 1/64). Recording is lock-free and may run concurrently with reading.
+class Histogram
+{
+public:
+    Histogram();
+
+    // disable copying
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void Record(uint64_t value);
+    void Merge(const Histogram& other);
+    void Reset();
+
+    uint64_t Count() const;
+    uint64_t Max() const;
+
+    // smallest value v such that at least p percent of the values are <= v (highest value of its bucket)
+    uint64_t Percentile(double p) const;
+
+    static const size_t BUCKETS = 64 * 59;
+
+private:
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_upper(size_t index);
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> m_counts;
+    std::atomic<uint64_t> m_count{ 0 };
+    std::atomic<uint64_t> m_max{ 0 };
+};
@@ -56,7 +56,7 @@ void write_error(const std::string& text, const error_code& ec)
     error = boost::str(boost::format("%1%: code=%2% %3%\n" ) % text % ec.value() % win32_message_english(ec.value()));
 #else
     //error = std::format("{}: code={} {} \n", text, ec.value(), ec.message());
-    error = boost::str(boost::format("%1%: code=%2% %3%\n") % text % ec.value() % (ec.what()));
+    error = boost::str(boost::format("%1%: code=%2% %3%\n") % text % ec.value() % ec.message());
 #endif
 
     std::cerr << error;
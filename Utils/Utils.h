@@ -5,6 +5,10 @@
 #include <cstring>
 #include <cmath>
 
+#if defined(_WIN32)
+#include <intrin.h>
+#endif
+
 
 inline bool double_equals(double a, double b, double epsilon = std::numeric_limits<double>::epsilon())
 {
@@ -66,3 +70,27 @@ static inline uint64_t host_to_net_u64(uint64_t x)
     return net_to_host_u64(x);
 }
 
+
+// x != 0
+static inline unsigned count_trailing_zeros_u64(uint64_t x)
+{
+#if defined(_WIN32)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return idx;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// x != 0
+static inline unsigned count_leading_zeros_u64(uint64_t x)
+{
+#if defined(_WIN32)
+    unsigned long idx;
+    _BitScanReverse64(&idx, x);
+    return 63 - idx;
+#else
+    return __builtin_clzll(x);
+#endif
+}